@@ -0,0 +1,205 @@
+#!python3
+
+"""
+Replays .cmds transcripts (see log2cmds.py) against Skald game builds and
+reports per-turn timings and reply sizes.  Each transcript is named for the
+game it came from (such as 30002-fate-skald.t3.cmds), and is only replayed
+against the game of the same story (fate, queen) being benchmarked.
+
+Each game is run headless with the -bench argument (see skaldBench in
+skaldserver.h), which builds every turn's reply just as a /skald/cmd request
+would and records how long that took.  Results can be saved as a baseline.
+Later runs are then compared against it: any timing or size that grew by
+more than the threshold is flagged, as is any turn whose footer (affordances
+and objects) differs from the baseline's.
+
+Exits with status 1 if anything was flagged.
+
+Created: 18 Oct 2026
+"""
+
+import argparse
+import glob
+import json
+import logging
+import os.path
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+
+from config import FROB, DEVNULL
+
+
+logging.basicConfig(level=logging.INFO, format='%(levelname)-7s: %(message)s')
+logger = logging.getLogger(__name__)
+
+GAMES = ['fate-skald.t3', 'queen-skald.t3']
+BASELINE = 'bench-baseline.json'
+BENCH_FILE = 'skald-bench.jsonl'  # as per skaldBench.FILENAME
+TIMEOUT = 600  # seconds allowed per transcript
+CMDS_NAME = re.compile(r'(?:\d+-)?([^-.]+)-.*\.cmds$')  # as from log2cmds.py
+
+# per-turn measures reported, with the function to extract each from a turn
+METRICS = {
+    'cmdMs': lambda t: t['cmdMs'],
+    'replyMs': lambda t: t['replyMs'],
+    'affordMs': lambda t: t['phases'].get('footer', 0),
+    'bytes': lambda t: t['bytes'],
+}
+
+# differences smaller than this are never regressions (ms timer resolution)
+MIN_DIFF = {'cmdMs': 2, 'replyMs': 2, 'affordMs': 2, 'bytes': 0}
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Benchmark Skald games by replaying .cmds transcripts.')
+    parser.add_argument('cmds_dir', help='directory of .cmds transcripts')
+    parser.add_argument('-g', '--game', action='append',
+        help='game file to run; may be repeated (default: {})'.format(
+            ', '.join(GAMES)))
+    parser.add_argument('-b', '--baseline', default=BASELINE,
+        help='baseline file to compare against or save (default: %(default)s)')
+    parser.add_argument('-s', '--save', action='store_true',
+        help='save these results as the new baseline')
+    parser.add_argument('-t', '--threshold', type=float, default=1.25,
+        help='flag a mean that grew by more than this ratio (default: %(default)s)')
+    args = parser.parse_args()
+
+    cmdsFiles = sorted(glob.glob(os.path.join(args.cmds_dir, '*.cmds')))
+    if not cmdsFiles:
+        logger.error('No .cmds files found in ' + args.cmds_dir)
+        return 1
+
+    results = {}
+    for game in (args.game or GAMES):
+        for cmds in storyCmds(game, cmdsFiles):
+            key = '{}|{}'.format(os.path.basename(game), os.path.basename(cmds))
+            logger.info('Running ' + key)
+            turns = runTranscript(game, cmds)
+            results[key] = {
+                'stats': summarize(turns),
+                'footers': [turn['footer'] for turn in turns],
+                'cmds': [turn['cmd'] for turn in turns],
+            }
+            printStats(key, results[key]['stats'])
+
+    flagged = 0
+    if os.path.exists(args.baseline):
+        with open(args.baseline, 'r') as f:
+            baseline = json.load(f)
+        flagged = compare(baseline, results, args.threshold)
+    elif not args.save:
+        logger.warning('No baseline found at ' + args.baseline)
+
+    if args.save:
+        with open(args.baseline, 'w') as f:
+            json.dump(results, f, indent=1)
+        logger.info('Saved baseline to ' + args.baseline)
+
+    return 1 if flagged else 0
+
+
+def storyCmds(game, cmdsFiles):
+    """
+    Returns those of the given .cmds files that are transcripts of the
+    given game's story.
+    """
+    story = os.path.basename(game).split('-')[0]
+    matched = [cmds for cmds in cmdsFiles if storyOf(cmds) == story]
+    if not matched:
+        logger.warning('No .cmds files for ' + game)
+    return matched
+
+
+def storyOf(cmds):
+    """
+    Returns the story named by the given .cmds file, or None if unknown.
+    """
+    m = CMDS_NAME.match(os.path.basename(cmds))
+    return m.group(1) if m else None
+
+
+def runTranscript(game, cmds):
+    """
+    Runs the given game file with the given .cmds file as input in benchmark
+    mode.  Returns the list of turn results (dicts) that the game recorded.
+    """
+    with tempfile.TemporaryDirectory() as work:
+        cmd = FROB.split() + ['-i', os.path.abspath(cmds),
+                              os.path.abspath(game), '-bench']
+        subprocess.run(cmd, cwd=work, stdin=DEVNULL, stdout=DEVNULL,
+                       stderr=DEVNULL, timeout=TIMEOUT)
+        with open(os.path.join(work, BENCH_FILE), 'r') as f:
+            return [json.loads(line) for line in f if line.strip()]
+
+
+def summarize(turns):
+    """
+    Returns {metric: {mean, median, p95, max, total}} for the given turns.
+    Turn 0 (the game's introduction) is skipped.
+    """
+    turns = turns[1:]
+    stats = {}
+    for name, get in METRICS.items():
+        values = sorted(get(turn) for turn in turns) or [0]
+        stats[name] = {
+            'mean': statistics.mean(values),
+            'median': statistics.median(values),
+            'p95': values[min(len(values) - 1, int(len(values) * 0.95))],
+            'max': values[-1],
+            'total': sum(values),
+        }
+    stats['turns'] = len(turns)
+    return stats
+
+
+def printStats(key, stats):
+    """
+    Prints a short summary of one transcript's stats.
+    """
+    print('{} ({} turns)'.format(key, stats['turns']))
+    for name in METRICS:
+        s = stats[name]
+        print('  {:9} mean {:9.1f}  median {:7}  p95 {:7}  max {:7}'.format(
+            name, s['mean'], s['median'], s['p95'], s['max']))
+
+
+def compare(baseline, results, threshold):
+    """
+    Compares results against baseline, logging any regressions and footer
+    differences.  Returns the number of problems found.
+    """
+    flagged = 0
+    for key, result in results.items():
+        if key not in baseline:
+            logger.warning('{}: not in baseline'.format(key))
+            continue
+        base = baseline[key]
+
+        for name in METRICS:
+            now = result['stats'][name]['mean']
+            before = base['stats'][name]['mean']
+            if now > before * threshold and now - before > MIN_DIFF[name]:
+                logger.error('{}: {} mean regressed from {:.1f} to {:.1f}'.format(
+                    key, name, before, now))
+                flagged += 1
+
+        if result['cmds'] != base['cmds']:
+            logger.warning('{}: commands differ from baseline; '
+                           'not comparing footers'.format(key))
+            continue
+        diffs = [i for i, (a, b) in
+                 enumerate(zip(result['footers'], base['footers'])) if a != b]
+        if diffs:
+            first = diffs[0]
+            logger.error('{}: {} footers differ from baseline, first at turn {} ({})'
+                         .format(key, len(diffs), first, result['cmds'][first]))
+            flagged += 1
+    return flagged
+
+
+if __name__ == "__main__":
+    sys.exit(main())
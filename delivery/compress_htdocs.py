@@ -0,0 +1,113 @@
+#!python3
+
+"""
+Writes precompressed variants of the Skald web files so that the game's
+server can send them compressed without compressing anything per request.
+Run before compiling a game, since the variants are bundled as resources
+along with the rest of tads-skald/htdocs.
+
+For every compressible file (see COMPRESS_EXTS), writes <file>.gz and, if the
+brotli module is installed, <file>.br alongside it.  A variant is only kept
+if it is actually smaller than the original.  Also writes a manifest listing
+every (uncompressed) file and which variants it has, one per line:
+
+  skald/skald.nocache.js gz br
+
+Created: 18 Oct 2026
+"""
+
+import gzip
+import logging
+import os
+import os.path
+import sys
+
+try:
+    import brotli
+except ImportError:
+    brotli = None
+
+
+logging.basicConfig(level=logging.INFO, format='%(levelname)-7s: %(message)s')
+logger = logging.getLogger(__name__)
+
+HTDOCS = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                      '..', 'fate', 'tads-skald', 'htdocs')
+MANIFEST = 'manifest.txt'  # as per skaldWebResources.MANIFEST
+
+# only text files are worth compressing (and are sent with a known MIME type)
+COMPRESS_EXTS = ['.html', '.css', '.js']
+
+# every variant suffix written, whether or not its encoder is available
+VARIANT_SUFFIXES = ['.gz', '.br']
+
+# suffix -> function that compresses bytes
+ENCODERS = {'.gz': lambda data: gzip.compress(data, 9, mtime=0)}
+if brotli:
+    ENCODERS['.br'] = lambda data: brotli.compress(data, quality=11)
+
+
+def main():
+    htdocs = sys.argv[1] if len(sys.argv) > 1 else HTDOCS
+    if not brotli:
+        logger.warning('brotli module not installed; writing only .gz files')
+
+    entries = []
+    for path in sorted(findFiles(htdocs)):
+        variants = compressFile(path)
+        entries.append(' '.join(
+            [os.path.relpath(path, htdocs).replace(os.sep, '/')] + variants))
+
+    with open(os.path.join(htdocs, MANIFEST), 'w', newline='\n') as f:
+        f.write('\n'.join(entries) + '\n')
+    logger.info('Wrote {} entries to {}'.format(len(entries), MANIFEST))
+
+
+def findFiles(htdocs):
+    """
+    Yields the path of every original file under htdocs: that is, excluding
+    the manifest and any previously written variants.  Removes any variants
+    of variants (such as a.js.br.gz) written by mistake in the past.
+    """
+    for dirpath, dirnames, filenames in os.walk(htdocs):
+        for name in filenames:
+            base, ext = os.path.splitext(name)
+            if ext in VARIANT_SUFFIXES and \
+                    os.path.splitext(base)[1] in VARIANT_SUFFIXES:
+                os.remove(os.path.join(dirpath, name))
+            if name == MANIFEST or ext in VARIANT_SUFFIXES:
+                continue
+            yield os.path.join(dirpath, name)
+
+
+def compressFile(path):
+    """
+    Writes the compressed variants of the given file, if it is compressible.
+    Returns the names of the encodings written (such as 'gz'), removing any
+    stale variants that are no longer worth keeping (or could not be
+    written this time, as when brotli is not installed).
+    """
+    written = []
+    compressible = os.path.splitext(path)[1].lower() in COMPRESS_EXTS
+    data = None
+    if compressible:
+        with open(path, 'rb') as f:
+            data = f.read()
+
+    for suffix in VARIANT_SUFFIXES:
+        variant = path + suffix
+        encode = ENCODERS.get(suffix)
+        packed = encode(data) if compressible and encode else None
+        if packed is not None and len(packed) < len(data):
+            with open(variant, 'wb') as f:
+                f.write(packed)
+            written.append(suffix[1:])
+            logger.debug('{}: {} -> {} bytes'.format(
+                variant, len(data), len(packed)))
+        elif os.path.exists(variant):
+            os.remove(variant)
+    return written
+
+
+if __name__ == "__main__":
+    main()
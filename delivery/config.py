@@ -33,12 +33,58 @@ TIMES_FILE = 'times.txt'
 BACKGROUND_SURVEY_URL = 'http://www.surveygizmo.com/s3/439469/Demeter-Evaluation-Consent-Background'
 RESPONSE_SURVEY_URL = 'http://www.surveygizmo.com/s3/439486/Demeter-Evaluation-Player-Response'
 
+# Location of TADS interpreter, with the options used to run it headless.
+FROB = '/usr/local/bin/frob --interface plain -N00 --no-pause'
+
 # Location of TADS interpreter capable of acting as a server
 # May include any TADS options, after which the game file will be appended.
-TADS = '/usr/local/bin/frob --interface plain -N00 --no-pause --webhost ' + FILES_URL_SERVER
+TADS = FROB + ' --webhost ' + FILES_URL_SERVER
 
 # Where to read/write to the void
 DEVNULL = subprocess.DEVNULL
 
 # Lowest port usable by users.  Should be divisible by 10 and must be >= 10000.
 MIN_USER_PORT = 30000
+
+# Directory of the Skald web files (as bundled into each game), served 
+# directly by frontend.py.
+HTDOCS_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), 
+                          '..', 'fate', 'tads-skald', 'htdocs')
+
+# Port that frontend.py listens on.
+FRONTEND_PORT = 8080
+
+# Game replies (to /skald/cmd and the like) at least this many bytes long are
+# gzipped by frontend.py for clients that accept it.  None = never.
+COMPRESS_MIN_BYTES = 1024
+
+# URL of the running frontend.py, with no slash at end.  If set, Skald games
+# are played through it rather than directly from each game's own port.
+# None = no frontend.
+FRONTEND_URL = None
+
+# Host that games started by serveGame() listen on, as reached by frontend.py.
+GAME_HOST = FILES_URL_SERVER
+
+# URL by which delivery.py reaches frontend.py on this same host, for 
+# requests (like pool claims) that it only accepts locally.
+FRONTEND_LOCAL_URL = 'http://127.0.0.1:' + str(FRONTEND_PORT)
+
+# If True, serveGame() claims an already-started game from frontend.py (which 
+# must be run with --pool) rather than starting one.  Requires FRONTEND_URL,
+# since pooled Skald games can only be reached through frontend.py.
+USE_POOL = False
+
+# Games that frontend.py keeps started and ready to claim (see gamepool.py),
+# and how many of each to keep ready.
+POOL_GAMES = ['fate-webui.t3', 'queen-skald.t3', 'fate-skald.t3', 'queen-webui.t3']
+POOL_SIZE = 2
+
+# If True, claimed Skald games save themselves and exit after a few idle
+# minutes, and are restarted from their save by the next request to them.
+HIBERNATE = False
+
+# Seconds an unclaimed game is kept before being replaced.  Must be less
+# than the game's own connection timeout or, if HIBERNATE, its hibernation
+# timeout (see startup.h).
+POOL_MAX_IDLE = 4 * 60
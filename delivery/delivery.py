@@ -27,8 +27,11 @@ import subprocess
 import time
 import random
 import time
+import json
+import urllib.request
 
 from config import *
+from gamepool import waitForReady
 
 # group 0: game 0, then 1  (port 1,4)
 # group 1: game 2, then 3. (port 2,3)
@@ -58,8 +61,8 @@ def runStudy():
       welcomePage(user, group)
       return
 
-    elif not re.compile(r"\d{1,5}$").match(user) or int(user) < MIN_USER_PORT or \
-            int(user) % 5 != 0:
+    elif not re.compile(r"\d{1,9}$" if USE_POOL else r"\d{1,5}$").match(user) or \
+            int(user) < MIN_USER_PORT or int(user) % 5 != 0:
         #bad user
         returnStatus(400, "Bad username format")
         return
@@ -293,6 +296,9 @@ def serveGame(game, user, stage=0):
     If a non-zero stage, will provide a landing page with the corresponding
     linke to click when done.
     
+    If USE_POOL, the game is instead claimed from frontend.py's pool, on
+    whatever port it was started on.  Pooled Skald games only listen on
+    127.0.0.1, so are played through FRONTEND_URL, which must be set.
     """
     if not game in GAMES:
         returnStatus(400, "Unsupported game requested.")
@@ -302,6 +308,21 @@ def serveGame(game, user, stage=0):
         serveGamePage(game, user, stage)
         return
 
+    if USE_POOL:
+        webui = game.endswith('-webui.t3')
+        if not webui and not FRONTEND_URL:
+            returnStatus(500, 'USE_POOL requires FRONTEND_URL for Skald games')
+            return
+        claimed = claimGame(game, user)
+        if not claimed:
+            returnStatus(500, 'Could not start game')
+            return
+        url, token = claimed
+        if not webui:
+            url = "{}/s/{}/".format(FRONTEND_URL, token)
+        redirect(url)
+        return
+
     port = int(user) + 1
     if game.startswith('queen'):
         port += 2
@@ -311,7 +332,10 @@ def serveGame(game, user, stage=0):
     else:
         port += 1
         tads_opts = ''
-        url = "http://{}:{}{}".format(FILES_URL_SERVER, port, FILES_URL_DIR)
+        if FRONTEND_URL:
+            url = "{}/g/{}/".format(FRONTEND_URL, port)
+        else:
+            url = "http://{}:{}{}".format(FILES_URL_SERVER, port, FILES_URL_DIR)
             
     # XXX: game must be in the current directory for a log file to be generated
     # by frobs/tads.  So must use only game name and set cwd to work.
@@ -328,29 +352,53 @@ def serveGame(game, user, stage=0):
                         stdin=DEVNULL,
                         stdout=open(outputfile, 'w'),
                         stderr=open(outputfile + '.err', 'w'))
-    #print(cmd)
-    time.sleep(1)  # give it a second to start
-
+    # wait for it to say it's listening (immediately if already started)
+    ready = waitForReady(outputfile)
+    if not ready:
+        returnStatus(500, 'Could not start game')
+        return
     if webui:
-        try:
-            with open(outputfile, 'r') as f:
-                for i in range(1): f.readline()  # skip over
-                url = f.readline()
-                #print(url)
-                url = url[len('connectWebUI:'):] # remove prefix
-                if not url.startswith('http:'):
-                    returnStatus(500, 'Could not start game')
-                    return
-        except IOError:
-            returnStatus(500, 'Could not start game--no link file generated')
-            return
-    
+        url = ready['url']
+
+    redirect(url)
+
+
+def redirect(url):
+    """
+    Sends a temporary redirect to the given url.
+    """
     print("Content-Type: text/html")
     print("Status: 307")
     print("Location: " + url)
     print()
 
 
+def claimGame(game, user):
+    """
+    Claims a started game from frontend.py's pool for the given user, unless
+    the user already has one.  Returns (url, token), where url is the game's
+    own and token is its frontend.py session.  Returns None on failure.
+
+    The claim is saved in DATA_DIR as <user>-<game>.port, and the port is
+    logged in the user's TIMES_FILE so their game logs can be found.
+    """
+    portFile = os.path.join(DATA_DIR, "{}-{}.port".format(user, game))
+    if os.path.exists(portFile):
+        with open(portFile, 'r') as f:
+            claimed = json.load(f)
+    else:
+        try:
+            reply = urllib.request.urlopen(
+                "{}/claim/{}".format(FRONTEND_LOCAL_URL, game), timeout=60)
+            claimed = json.loads(reply.read().decode())
+        except (IOError, ValueError):
+            return None
+        with open(portFile, 'w') as f:
+            json.dump(claimed, f)
+        logTime(user, "Port=" + str(claimed['port']))
+    return claimed['url'], claimed['token']
+
+
 def serveGamePage(game, user, stage):
     """
     Creates a landing page with a link to start a game in a new window
@@ -0,0 +1,541 @@
+#!python3
+
+"""
+A front-end web server for Skald games.  Serves the Skald web files (see
+HTDOCS_DIR) itself, and forwards only the game's own endpoints to the game.
+
+The TADS server in each game is single-threaded, so it can only answer a
+request while waiting for a command; during a long turn even a stylesheet
+has to wait.  Every game also serves its own copy of the web files.  This
+server instead answers all static requests from one shared in-memory cache
+(with ETags, long-lived caching of GWT's *.cache.* files, and gzip/brotli
+compression), so the games only ever see /skald/ API requests.  Game
+replies of COMPRESS_MIN_BYTES or more are gzipped on the way through, as
+their affordance footers are very repetitive.
+
+A game started by delivery.py on port P (on GAME_HOST) is played at:
+
+  http://<frontend>/g/P/
+
+where P must be a port serveGame() starts a Skald game on: a user's base
+port (MIN_USER_PORT plus a multiple of 10) plus 2 or 4.  Ports of pooled
+games are refused here, as those are reached only by session token.
+
+Run with --pool to also keep a pool of started games (see gamepool.py).
+These listen only on 127.0.0.1, on system-chosen ports, and are reached
+only by session token.  delivery.py claims one with a request (from this
+host only) to:
+
+  http://<frontend>/claim/<game file>
+
+which replies with JSON like {"port": 40002, "url": "http://...", 
+"token": "..."}.  The claimed game is then played at:
+
+  http://<frontend>/s/<token>/
+
+Responses there also set a SESSION_COOKIE, so requests without the /s/
+prefix still reach the right game.  All players thus share one public port.
+If the session's game has hibernated, it is resumed by the next request.
+
+The byte counts of game replies before and after compression can be
+fetched as JSON (from this host only) at:
+
+  http://<frontend>/stats
+
+A client may instead open a WebSocket to .../skald/ws under either prefix,
+over which it sends its requests and receives both replies and any output
+the game produces between commands (see wsbridge.py).
+
+Created: 18 Oct 2026
+"""
+
+import argparse
+import gzip
+import hashlib
+import http.client
+import http.server
+import json
+import logging
+import mimetypes
+import os.path
+import re
+import secrets
+import socketserver
+import sys
+import threading
+
+from config import HTDOCS_DIR, FRONTEND_PORT, MIN_USER_PORT, GAME_HOST, \
+                   COMPRESS_MIN_BYTES
+import gamepool
+import wsbridge
+
+
+logging.basicConfig(level=logging.INFO, format='%(levelname)-7s: %(message)s')
+logger = logging.getLogger(__name__)
+
+# paths (under a game's /g/P or /s/T prefix) that are sent on to the game
+GAME_ENDPOINTS = ['/skald/init', '/skald/cmd', '/skald/batch',
+                  '/skald/affordances', '/skald/profile', '/skald/events']
+WEBSOCKET_PATH = '/skald/ws'
+
+# game request headers that are forwarded to it
+FORWARD_HEADERS = ['Content-Type']
+
+GAME_PATH = re.compile(r'/g/(\d{1,5})(/[^?]*)(\?.*)?$')
+SESSION_PATH = re.compile(r'/s/([\w-]{16,})(/[^?]*)(\?.*)?$')
+CLAIM_PATH = re.compile(r'/claim/([\w.-]+)$')
+STATS_PATH = '/stats'
+PLAIN_PATH = re.compile(r'(/[^?]*)(\?.*)?$')
+SESSION_COOKIE = 'skald_session'
+
+PROXY_TIMEOUT = 60  # seconds to wait for a game to reply
+IMMUTABLE_MAX_AGE = 31536000  # seconds, as per SkaldCachedResource
+
+# as per compress_htdocs.py: preferred encodings first
+ENCODINGS = [('br', '.br'), ('gzip', '.gz')]
+COMPRESS_TYPES = ['text/html', 'text/css', 'application/javascript',
+                  'text/javascript']
+REPLY_COMPRESS_LEVEL = 6  # replies are compressed per request, so not 9
+
+
+class StaticFile:
+    """
+    A web file, loaded into memory along with any compressed copies.
+    """
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        self.mimeType = mimetypes.guess_type(path)[0] or \
+                        'application/octet-stream'
+        self.etag = '"' + hashlib.md5(self.data).hexdigest() + '"'
+        self.immutable = '.cache.' in os.path.basename(path)
+
+        # encoding -> (data, etag)
+        self.variants = {}
+        for encoding, suffix in ENCODINGS:
+            if os.path.exists(path + suffix):
+                with open(path + suffix, 'rb') as f:
+                    self.addVariant(encoding, f.read())
+        if 'gzip' not in self.variants and self.mimeType in COMPRESS_TYPES:
+            # not precompressed, so compress it once now
+            packed = gzip.compress(self.data, 9)
+            if len(packed) < len(self.data):
+                self.addVariant('gzip', packed)
+
+    def addVariant(self, encoding, data):
+        self.variants[encoding] = (data, self.etag[:-1] + '-' + encoding + '"')
+
+    def choose(self, acceptEncoding):
+        """
+        Returns (encoding, data, etag) for the variant best suited to the
+        given Accept-Encoding header value.  encoding is None for the
+        uncompressed original.
+        """
+        accepted = parseAcceptEncoding(acceptEncoding or '')
+        for encoding, suffix in ENCODINGS:
+            if encoding in self.variants and encoding in accepted:
+                data, etag = self.variants[encoding]
+                return encoding, data, etag
+        return None, self.data, self.etag
+
+
+class StaticFiles:
+    """
+    Cache of StaticFiles under a root directory, loaded on first request.
+    """
+
+    def __init__(self, root):
+        self.root = os.path.realpath(root)
+        self.files = {}
+
+    def get(self, urlPath):
+        """
+        Returns the StaticFile for the given URL path (such as
+        '/skald/skald.nocache.js'), or None if there isn't one.
+        """
+        if urlPath.endswith('/'):
+            urlPath += 'index.html'
+        if urlPath in self.files:
+            return self.files[urlPath]
+        path = os.path.realpath(os.path.join(self.root, urlPath.lstrip('/')))
+        if not path.startswith(self.root + os.sep) or not os.path.isfile(path):
+            return None
+        f = StaticFile(path)
+        self.files[urlPath] = f  # harmless if two threads race to load it
+        return f
+
+
+class ReplyStats:
+    """
+    Counts the bytes of game replies proxied, before and after compression.
+    """
+
+    def __init__(self):
+        self.replies = 0
+        self.compressed = 0   # how many of the replies were compressed
+        self.bytesIn = 0      # as received from the games
+        self.bytesOut = 0     # as sent to clients
+        self.lock = threading.Lock()
+
+    def add(self, before, after, compressed):
+        with self.lock:
+            self.replies += 1
+            self.compressed += 1 if compressed else 0
+            self.bytesIn += before
+            self.bytesOut += after
+
+    def toJson(self):
+        with self.lock:
+            return json.dumps({'replies': self.replies,
+                               'compressed': self.compressed,
+                               'bytesIn': self.bytesIn,
+                               'bytesOut': self.bytesOut})
+
+
+def compressReply(data, contentType, acceptEncoding):
+    """
+    Returns the given game reply gzipped if it is large enough to be worth it
+    and the client accepts gzip; otherwise returns None.
+    """
+    if COMPRESS_MIN_BYTES is None or len(data) < COMPRESS_MIN_BYTES:
+        return None
+    mimeType = (contentType or 'text/html').split(';')[0].strip()
+    if mimeType not in COMPRESS_TYPES + ['application/json'] or \
+            'gzip' not in parseAcceptEncoding(acceptEncoding or ''):
+        return None
+    packed = gzip.compress(data, REPLY_COMPRESS_LEVEL)
+    return packed if len(packed) < len(data) else None
+
+
+def parseAcceptEncoding(header):
+    """
+    Returns the set of encodings the given Accept-Encoding value allows.
+    """
+    accepted = set()
+    for item in header.lower().split(','):
+        parts = [p.strip() for p in item.split(';')]
+        rejected = any(re.match(r'q\s*=\s*0(\.0*)?$', p) for p in parts[1:])
+        if parts[0] and not rejected:
+            accepted.add(parts[0])
+    return accepted
+
+
+class FrontendHandler(http.server.BaseHTTPRequestHandler):
+    """
+    Serves static files from the shared cache, and proxies game endpoints.
+    """
+    protocol_version = 'HTTP/1.1'
+    static = None  # set to a StaticFiles by main()
+    pool = None    # set to a GamePool by main(), if pooling
+    sessions = {}  # token -> claimed GameProcess
+    sessionsLock = threading.Lock()  # only held briefly; never while resuming
+    resumeLocks = {}  # token -> Lock held while resuming that session's game
+    stats = ReplyStats()
+
+    def do_GET(self):
+        self.handle_any(body=True)
+
+    def do_HEAD(self):
+        self.handle_any(body=False)
+
+    def do_POST(self):
+        self.handle_any(body=True)
+
+    def handle_any(self, body):
+        claim = CLAIM_PATH.match(self.path)
+        if claim:
+            self.claim(claim.group(1))
+            return
+        if self.path == STATS_PATH:
+            self.sendStats()
+            return
+        route = self.route()
+        if not route:
+            self.sendError(404)
+            return
+        host, port, path, query, cookie, token = route
+        if port is None:
+            self.sendError(410)  # session's game has ended
+            return
+
+        if path in GAME_ENDPOINTS:
+            self.proxy(host, port, path + query)
+            return
+        if path == WEBSOCKET_PATH:
+            self.websocket(host, port, token)
+            return
+        f = self.static.get(path)
+        if f is None or self.command == 'POST':
+            self.sendError(404)
+        else:
+            self.sendStatic(f, body, cookie)
+
+    def route(self):
+        """
+        Works out which game this request is for.  Returns (host, port, path,
+        query, cookie, token), where path and query are what remains of the
+        request path, cookie is a Set-Cookie header value to send, if any,
+        and token is the session's, if any.  port is None if the request is
+        for a session whose game has ended.  Returns None if the request is
+        not for any game.
+        """
+        m = SESSION_PATH.match(self.path)
+        if m:
+            token = m.group(1)
+            host, port = self.getSession(token)
+            cookie = '{}={}; Path=/; HttpOnly'.format(SESSION_COOKIE, token)
+            return host, port, m.group(2), m.group(3) or '', cookie, token
+
+        m = GAME_PATH.match(self.path)
+        if m:
+            port = int(m.group(1))
+            if not self.isUserPort(port):
+                return None
+            return GAME_HOST, port, m.group(2), m.group(3) or '', None, None
+
+        token = self.getCookie(SESSION_COOKIE)
+        m = PLAIN_PATH.match(self.path)
+        if token and m and token in self.sessions:
+            host, port = self.getSession(token)
+            return host, port, m.group(1), m.group(2) or '', None, token
+        return None
+
+    def isUserPort(self, port):
+        """
+        Whether the given port may be played at /g/<port>/: one serveGame()
+        starts a Skald game on, and not one of the pool's games.
+        """
+        if port < MIN_USER_PORT or port > 65535 or \
+                (port - MIN_USER_PORT) % 10 not in (2, 4):
+            return False
+        if self.pool is None:
+            return True
+        with self.pool.lock:
+            return all(p.port != port for p in self.pool.running)
+
+    def getSession(self, token):
+        """
+        Returns (host, port) of the given session's game, or (None, None) if
+        there is no such session or its game has ended.  Resumes the game
+        first if it has hibernated, which only holds up requests to the same
+        session.
+        """
+        with self.sessionsLock:
+            proc = self.sessions.get(token)
+            if proc is None or proc.alive():
+                return (proc.host, proc.port) if proc else (None, None)
+            resumeLock = self.resumeLocks.setdefault(token, threading.Lock())
+
+        with resumeLock:
+            with self.sessionsLock:
+                proc = self.sessions.get(token)
+            if proc and not proc.alive():
+                # not resumed by another request while we waited, so do it
+                resumed = self.pool.resume(proc)
+                with self.sessionsLock:
+                    if resumed:
+                        self.sessions[token] = resumed
+                    else:
+                        self.sessions.pop(token, None)
+                        self.resumeLocks.pop(token, None)
+                proc = resumed
+        return (proc.host, proc.port) if proc else (None, None)
+
+    def getCookie(self, name):
+        for header in self.headers.get_all('Cookie') or []:
+            for item in header.split(';'):
+                key, sep, value = item.strip().partition('=')
+                if key == name:
+                    return value
+        return None
+
+    def claim(self, game):
+        """
+        Takes a started game from the pool and replies with its port and URL.
+        Only allowed from this host.
+        """
+        if self.pool is None or not self.isLocal():
+            self.sendError(404)
+            return
+        proc = self.pool.claim(game)
+        if proc is None:
+            self.sendError(503)
+            return
+        token = secrets.token_urlsafe(16)
+        with self.sessionsLock:
+            self.sessions[token] = proc
+        logger.info('Claimed {} on port {}'.format(game, proc.port))
+        data = json.dumps({'port': proc.port, 'url': proc.url,
+                           'token': token}).encode()
+        self.send_response(200)
+        self.sendHeaders([('Content-Type', 'application/json'),
+                          ('Cache-Control', 'no-store'),
+                          ('Content-Length', str(len(data)))])
+        self.wfile.write(data)
+
+    def sendStats(self):
+        """
+        Replies with the reply byte counts as JSON.  Only allowed from this
+        host.
+        """
+        if not self.isLocal():
+            self.sendError(404)
+            return
+        data = self.stats.toJson().encode()
+        self.send_response(200)
+        self.sendHeaders([('Content-Type', 'application/json'),
+                          ('Cache-Control', 'no-store'),
+                          ('Content-Length', str(len(data)))])
+        self.wfile.write(data)
+
+    def isLocal(self):
+        return self.client_address[0] in ('127.0.0.1', '::1')
+
+    def sendStatic(self, f, body, cookie=None):
+        """
+        Sends the given StaticFile, or a 304 if the client already has it.
+        Also sets the given cookie, if any.
+        """
+        encoding, data, etag = f.choose(self.headers.get('Accept-Encoding'))
+        headers = [('ETag', etag), ('Cache-Control',
+                   'public, max-age={}, immutable'.format(IMMUTABLE_MAX_AGE)
+                   if f.immutable else 'no-cache')]
+        if f.variants:
+            headers.append(('Vary', 'Accept-Encoding'))
+        if cookie and not f.immutable:
+            headers.append(('Set-Cookie', cookie))
+
+        match = self.headers.get('If-None-Match')
+        if match and (match.strip() == '*' or etag in match):
+            self.send_response(304)
+            self.sendHeaders(headers + [('Content-Length', '0')])
+            return
+
+        self.send_response(200)
+        if encoding:
+            headers.append(('Content-Encoding', encoding))
+        self.sendHeaders(headers + [('Content-Type', f.mimeType),
+                                    ('Content-Length', str(len(data)))])
+        if body:
+            self.wfile.write(data)
+
+    def proxy(self, host, port, path):
+        """
+        Forwards this request to the game on the given host and port and
+        relays its reply.  Sends a 502 if the game could not be reached.
+        """
+        length = int(self.headers.get('Content-Length', 0))
+        reqBody = self.rfile.read(length) if length else None
+        headers = {h: self.headers[h] for h in FORWARD_HEADERS if h in self.headers}
+        try:
+            status, contentType, data = forward(host, port, self.command,
+                                                path, reqBody, headers)
+        except OSError as e:
+            logger.warning('Port {}: {}'.format(port, e))
+            self.sendError(502)
+            return
+
+        headers = [('Content-Type', contentType or 'text/html'),
+                   ('Cache-Control', 'no-store'), ('Vary', 'Accept-Encoding')]
+        packed = compressReply(data, contentType,
+                               self.headers.get('Accept-Encoding'))
+        self.stats.add(len(data), len(packed or data), packed is not None)
+        if packed is not None:
+            data = packed
+            headers.append(('Content-Encoding', 'gzip'))
+
+        self.send_response(status)
+        self.sendHeaders(headers + [('Content-Length', str(len(data)))])
+        if self.command != 'HEAD':
+            self.wfile.write(data)
+
+    def websocket(self, host, port, token=None):
+        """
+        Upgrades this connection to a WebSocket carrying requests to the
+        game on the given host and port (see wsbridge.py).  If given a
+        session token, the game is instead looked up again for each request,
+        as it moves to a new port whenever it is resumed.
+        """
+        key = self.headers.get('Sec-WebSocket-Key')
+        if self.headers.get('Upgrade', '').lower() != 'websocket' or not key:
+            self.sendError(400)
+            return
+        self.send_response(101)
+        self.sendHeaders([('Upgrade', 'websocket'), ('Connection', 'Upgrade'),
+                          ('Sec-WebSocket-Accept', wsbridge.acceptKey(key))])
+        self.wfile.flush()
+        self.close_connection = True
+
+        def post(path, body):
+            gameHost, gamePort = self.getSession(token) if token else (host, port)
+            if gamePort is None:
+                raise OSError('session has ended')
+            status, contentType, data = forward(gameHost, gamePort, 'POST',
+                                                path, body)
+            return status, data
+        wsbridge.GameSocket(self.rfile, self.wfile, post).run()
+
+    def sendHeaders(self, headers):
+        for name, value in headers:
+            self.send_header(name, value)
+        self.end_headers()
+
+    def sendError(self, status):
+        data = '{} {}\n'.format(status, self.responses[status][0]).encode()
+        self.send_response(status)
+        self.sendHeaders([('Content-Type', 'text/plain'),
+                          ('Content-Length', str(len(data)))])
+        if self.command != 'HEAD':
+            self.wfile.write(data)
+
+    def log_message(self, format, *args):
+        logger.debug(format % args)
+
+
+def forward(host, port, method, path, body=None, headers={}):
+    """
+    Sends a request to the game on the given host and port.  Returns the
+    reply's (status, Content-Type, data).  Raises OSError on failure.
+    """
+    conn = http.client.HTTPConnection(host, port, timeout=PROXY_TIMEOUT)
+    try:
+        conn.request(method, path, body, headers)
+        reply = conn.getresponse()
+        return reply.status, reply.getheader('Content-Type'), reply.read()
+    except http.client.HTTPException as e:
+        raise OSError(e)
+    finally:
+        conn.close()
+
+
+class FrontendServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Serve Skald web files and proxy requests to games.')
+    parser.add_argument('-p', '--port', type=int, default=FRONTEND_PORT,
+        help='port to listen on (default: %(default)s)')
+    parser.add_argument('-d', '--htdocs', default=HTDOCS_DIR,
+        help='directory of web files to serve (default: %(default)s)')
+    parser.add_argument('--pool', action='store_true',
+        help='keep started games ready for delivery.py to claim')
+    args = parser.parse_args()
+
+    FrontendHandler.static = StaticFiles(args.htdocs)
+    if args.pool:
+        FrontendHandler.pool = gamepool.GamePool()
+        FrontendHandler.pool.start()
+    server = FrontendServer(('', args.port), FrontendHandler)
+    logger.info('Serving {} on port {}'.format(args.htdocs, args.port))
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,355 @@
+#!python3
+
+"""
+Keeps a pool of already-started game interpreters, so that a new player
+gets a game that has already loaded and run its preinit rather than waiting
+for one to start.
+
+Each game in POOL_GAMES gets POOL_SIZE idle processes, each on a free port
+chosen by the system.  Skald games only listen on 127.0.0.1, as they are
+reached through frontend.py; WebUI games are still played directly.
+claim() hands one out and a background thread starts its replacement.
+
+If HIBERNATE, claimed Skald games save themselves and exit when idle (see
+skaldServer.hibernate()); resume() starts such a game again from its save.
+Saves are named by session (see GameProcess), not port, since a hibernated
+game's port may be reused by another game in the meantime.
+resume() also restarts a Skald game that has crashed, recovering it from
+its journal (see skaldJournal), unless it crashed again right after its
+last recovery.  Idle processes are retired after POOL_MAX_IDLE seconds,
+since a game shuts itself down if it goes too long without a request (see
+startup.h).
+
+Used by frontend.py, which serves claims to delivery.py.
+
+Created: 18 Oct 2026
+"""
+
+import json
+import logging
+import os
+import os.path
+import secrets
+import socket
+import subprocess
+import threading
+import time
+
+from config import *
+
+
+logger = logging.getLogger(__name__)
+
+READY_TIMEOUT = 30  # seconds a game may take to start
+READY_POLL = 0.02   # seconds between checks that a game has started
+MAINTAIN_EVERY = 1  # seconds between pool top-ups and clean-ups
+
+
+class GameProcess:
+    """
+    A running game interpreter serving on a port.
+    """
+
+    def __init__(self, game, port, restoreFile=None, journal=None, session=None):
+        """
+        Starts the game from restoreFile, if given, carrying on the given
+        journal.  If given only a journal, recovers the game from it.
+        session names the game's saved files; a new one is made if None.
+        """
+        self.game = game
+        self.port = port
+        self.session = session or '{}-{}'.format(secrets.token_hex(8), game)
+        self.journal = journal or os.path.join(DATA_DIR, self.session + '.journal')
+        # a recovery fails if the game crashes again before journaling a cmd
+        self.recovering = bool(journal and not restoreFile)
+        self.journalSize = journalSize(self.journal) if self.recovering else None
+        self.webui = game.endswith('-webui.t3')
+        self.host = FILES_URL_SERVER if self.webui else '127.0.0.1'
+        self.url = None
+        self.outputFile = os.path.join(DATA_DIR, '{}-{}.output'.format(port, game))
+        keepOldLog(os.path.join(DATA_DIR, '{}-{}.log'.format(port, game)))
+
+        # XXX: game must be in the current directory for a log file to be
+        # generated by frob.  So must use only game name and set cwd.
+        # (Not run through a shell, so that stop() reaches the game itself.)
+        cmd = TADS.split() + [game, str(port)]
+        if not self.webui:
+            cmd += ['-local', '-session', self.session]
+            if HIBERNATE:
+                cmd.append('-hibernate')
+            if restoreFile:
+                cmd += ['-restore', restoreFile]
+            elif journal:
+                # relative to cwd, since the game writes to it
+                cmd += ['-recover', os.path.relpath(journal, DATA_DIR)]
+        with open(self.outputFile, 'w') as out, \
+                open(self.outputFile + '.err', 'w') as err:
+            self.process = subprocess.Popen(cmd, close_fds=True, cwd=DATA_DIR,
+                                            stdin=DEVNULL, stdout=out, stderr=err)
+        self.started = time.time()
+
+    def alive(self):
+        return self.process.poll() is None
+
+    def crashed(self):
+        """
+        Whether the game has exited with an error (rather than quitting).
+        """
+        return self.process.poll() not in (None, 0)
+
+    def waitReady(self, timeout=READY_TIMEOUT):
+        """
+        Blocks until this game says it is accepting requests, then sets
+        self.url (and self.journal, as the game may have had to pick another
+        name).  Returns False if it exits or takes longer than timeout
+        seconds.
+        """
+        ready = waitForReady(self.outputFile, timeout, self.alive)
+        if ready:
+            self.url = ready['url']
+            if ready.get('journal'):
+                self.journal = os.path.join(DATA_DIR, ready['journal'])
+        return ready is not None
+
+    def failedRecovery(self):
+        """
+        Whether this game was recovered from its journal but crashed again
+        before getting any further, so recovering it again would only repeat
+        that.
+        """
+        return self.recovering and self.crashed() and \
+               journalSize(self.journal) == self.journalSize
+
+    def removeJournal(self):
+        """
+        Deletes this game's journal and its snapshots (see skaldJournal).
+        """
+        for path in [self.journal, self.journal + '.1.t3v',
+                     self.journal + '.2.t3v']:
+            if os.path.exists(path):
+                os.remove(path)
+
+    def hibernatedFile(self):
+        """
+        Returns the path of the file this game saved itself to on exiting,
+        or None if it did not hibernate.
+        """
+        try:
+            with open(self.outputFile, 'r') as f:
+                for line in f:
+                    if line.startswith('SKALD-HIBERNATED:'):
+                        saved = json.loads(line[len('SKALD-HIBERNATED:'):])
+                        return os.path.join(DATA_DIR, saved['file'])
+        except (IOError, ValueError):
+            pass
+        return None
+
+    def stop(self):
+        if self.alive():
+            self.process.terminate()
+
+
+class GamePool:
+    """
+    Pools of ready GameProcesses, by game.
+    """
+
+    def __init__(self, games=POOL_GAMES, size=POOL_SIZE):
+        self.size = size
+        self.idle = {game: [] for game in games}  # ready to claim
+        self.starting = {game: 0 for game in games}
+        self.running = []  # every live process, so its port is not reused
+        self.lock = threading.Lock()
+
+    def start(self):
+        """
+        Starts the background thread that fills and cleans the pools.
+        """
+        threading.Thread(target=self.maintain, daemon=True).start()
+
+    def claim(self, game):
+        """
+        Returns a ready GameProcess for the given game, removing it from the
+        pool.  Only starts one on the spot if none are ready.  Returns None
+        if the game is unknown or fails to start.
+        """
+        if game not in self.idle:
+            return None
+        with self.lock:
+            while self.idle[game]:
+                proc = self.idle[game].pop(0)
+                if proc.alive():
+                    return proc
+        logger.warning('{}: pool empty, so starting a game now'.format(game))
+        proc = self.launch(game)
+        if proc and proc.waitReady():
+            return proc
+        if proc:
+            proc.stop()
+        return None
+
+    def resume(self, proc):
+        """
+        Restarts the given game, which has hibernated or crashed, from its
+        save or else its journal.  Returns the new GameProcess once it is
+        ready, or None on failure.  Gives up on a game that crashed again
+        right after being recovered.
+        """
+        saved = proc.hibernatedFile()
+        if saved and os.path.exists(saved):
+            resumed = self.launch(proc.game, saved, proc.journal, proc.session)
+        elif proc.failedRecovery():
+            logger.error('{}: crashed again once recovered from {}'.format(
+                proc.game, proc.journal))
+            proc.removeJournal()
+            return None
+        elif proc.crashed() and os.path.exists(proc.journal):
+            saved = proc.journal
+            resumed = self.launch(proc.game, None, proc.journal, proc.session)
+        else:
+            return None
+        if resumed and resumed.waitReady():
+            logger.info('{}: resumed from {} on port {}'.format(
+                proc.game, saved, resumed.port))
+            if saved != proc.journal:
+                os.remove(saved)
+            return resumed
+        if resumed:
+            resumed.stop()
+        return None
+
+    def maintain(self):
+        while True:
+            try:
+                self.cleanUp()
+                for game in self.idle:
+                    with self.lock:
+                        needed = self.size - len(self.idle[game]) - self.starting[game]
+                        self.starting[game] += max(needed, 0)
+                    for i in range(needed):
+                        threading.Thread(target=self.addIdle, args=(game,),
+                                         daemon=True).start()
+            except Exception:
+                logger.exception('Pool maintenance failed')
+            time.sleep(MAINTAIN_EVERY)
+
+    def addIdle(self, game):
+        """
+        Starts a game and, once ready, adds it to the pool.
+        """
+        proc = self.launch(game)
+        ready = proc is not None and proc.waitReady()
+        with self.lock:
+            self.starting[game] -= 1
+            if ready:
+                self.idle[game].append(proc)
+        if proc and not ready:
+            logger.error('{} on port {} failed to start'.format(game, proc.port))
+            proc.stop()
+
+    def cleanUp(self):
+        """
+        Retires idle games that are about to time out, and forgets games that
+        have ended.
+        """
+        now = time.time()
+        with self.lock:
+            for game, procs in self.idle.items():
+                old = [p for p in procs if now - p.started > POOL_MAX_IDLE]
+                for p in old:
+                    p.stop()
+                self.idle[game] = [p for p in procs if p.alive() and p not in old]
+            self.running = [p for p in self.running if p.alive()]
+
+    def launch(self, game, restoreFile=None, journal=None, session=None):
+        """
+        Starts the given game (as per GameProcess) on a free port and returns
+        its GameProcess, or None if there are no free ports.
+        """
+        with self.lock:
+            port = self.takePort()
+            if port is None:
+                logger.error('No free ports for ' + game)
+                return None
+            proc = GameProcess(game, port, restoreFile, journal, session)
+            self.running.append(proc)
+            return proc
+
+    def takePort(self):
+        """
+        Returns a free port, as chosen by the system, that no game of ours is
+        using.  Returns None if the system has no ports to give.  Call only 
+        while holding self.lock.
+        """
+        used = set(p.port for p in self.running)
+        for i in range(10):
+            try:
+                with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+                    s.bind(('', 0))
+                    port = s.getsockname()[1]
+            except OSError:
+                return None
+            if port not in used:
+                return port
+        return None
+
+
+def waitForReady(outputFile, timeout=READY_TIMEOUT, alive=lambda: True):
+    """
+    Watches the given game output file for the line the game prints once it
+    is ready for requests: SKALD-READY for Skald games (see skaldServer.
+    announceReady()) or connectWebUI for WebUI ones.  Returns a dict of its
+    details (including the game's 'url'), or None if timeout seconds pass or
+    alive() returns False first.
+    """
+    end = time.time() + timeout
+    while True:
+        ready = readReady(outputFile)
+        if ready or time.time() >= end or not alive():
+            return ready
+        time.sleep(READY_POLL)
+
+
+def readReady(outputFile):
+    """
+    Returns the details of the ready line in the given output file, as per
+    waitForReady(), or None if it has not been printed yet.
+    """
+    try:
+        with open(outputFile, 'r') as f:
+            for line in f:
+                if line.startswith('SKALD-READY:'):
+                    ready = json.loads(line[len('SKALD-READY:'):])
+                    # a -local game can only be reached from this host
+                    host = ready['host'] if ready['host'] == '127.0.0.1' \
+                           else FILES_URL_SERVER
+                    ready['url'] = "http://{}:{}{}".format(
+                        host, ready['port'], FILES_URL_DIR)
+                    return ready
+                if line.startswith('connectWebUI:'):
+                    url = line[len('connectWebUI:'):].strip()
+                    if url.startswith('http:'):
+                        return {'mode': 'webui', 'url': url}
+    except (IOError, ValueError):
+        pass
+    return None
+
+
+def journalSize(filename):
+    """
+    Returns the size of the given journal, or None if there is none.
+    """
+    try:
+        return os.path.getsize(filename)
+    except OSError:
+        return None
+
+
+def keepOldLog(filename):
+    """
+    Ports are reused, so renames any log left by a previous game on the same
+    port rather than let the new game overwrite it.
+    """
+    if os.path.exists(filename):
+        base, ext = os.path.splitext(filename)
+        os.rename(filename, '{}.{}{}'.format(base, int(time.time()), ext))
@@ -0,0 +1,220 @@
+#!python3
+
+"""
+Summarizes every game session log in a data directory (see DATA_DIR) into a
+single columnar JSON file, so that aggregate numbers can be had without
+reading the raw logs again.
+
+Each <port>-<game>.log is one session, as is each earlier log on the same
+port renamed by gamepool.keepOldLog() to <port>-<game>.<timestamp>.log.
+Logs are read a line at a time, many at once across worker processes.  As
+in log2cmds.py, commands are the "CMD: " lines of Skald logs and the <line>
+lines of TADS ones.  Skald logs also give the size, time and end of each
+reply (see skaldLog's REPLY lines).
+
+A session's end is its last REPLY, or else when its log was last written
+to (which, for a TADS log, includes any idle time before it timed out).
+Its start time is taken from its user's TIMES_FILE (see delivery.py's
+logTime): the last entry made before its end, which is the stage, Game= or
+Port= entry that launched it.  The user is found from the last Port= entry
+for the log's port made before then (as pooled ports are reused).  Failing
+that, a log from before pooling began is matched to a user by its port (as
+assigned by serveGame); a later one is not, as a resumed game runs on a new
+port that no user claimed.
+
+The output looks like:
+
+  {"columns": ["log", "user", ...],
+   "rows": 1234,
+   "data": {"log": ["30001-fate-webui.t3.log", ...], "user": [30000, ...], ...}}
+
+where each column is a list with one value (or null) per session.
+
+Created: 18 Oct 2026
+"""
+
+import argparse
+import glob
+import json
+import logging
+import multiprocessing
+import os
+import os.path
+import re
+import statistics
+import sys
+
+from config import DATA_DIR, TIMES_FILE
+
+
+logging.basicConfig(level=logging.INFO, format='%(levelname)-7s: %(message)s')
+logger = logging.getLogger(__name__)
+
+OUTPUT = 'log-summary.json'
+
+LOG_NAME = re.compile(r'(\d+)-(.+\.t3)(\.\d+)?\.log$')
+TIMES_LINE = re.compile(r'(.*?): .* = (\d+)$')
+REPLY_LINE = re.compile(r'REPLY: (\d+) chars \((\d+)ms\)(?: at (\d+))?')
+
+# one per session, in this order
+COLUMNS = ['log', 'user', 'game', 'port', 'cmds', 'start', 'seconds',
+           'turnSeconds', 'replies', 'replyChars', 'maxReplyChars',
+           'meanReplyMs', 'maxReplyMs']
+CHUNKS_PER_JOB = 8  # logs are handed out in chunks, for balance
+
+# set in each worker by initWorker()
+times = None      # as per readAllTimes()
+portUsers = None  # port -> [(time, user), ...], from Port= entries
+poolStart = None  # time of the first Port= entry, if any
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Summarize game session logs into one columnar JSON file.')
+    parser.add_argument('data_dir', nargs='?', default=DATA_DIR,
+        help='directory of logs and times files (default: %(default)s)')
+    parser.add_argument('-o', '--output', default=OUTPUT,
+        help='file to write the summary to (default: %(default)s)')
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(),
+        help='number of worker processes (default: %(default)s)')
+    args = parser.parse_args()
+
+    logs = sorted(glob.glob(os.path.join(args.data_dir, '*.log')))
+    logs = [log for log in logs if LOG_NAME.match(os.path.basename(log))]
+    if not logs:
+        logger.error('No session logs found in ' + args.data_dir)
+        return 1
+    allTimes = readAllTimes(args.data_dir)
+    logger.info('Summarizing {} logs ({} users) with {} workers'.format(
+        len(logs), len(allTimes), args.jobs))
+
+    chunk = max(1, len(logs) // (args.jobs * CHUNKS_PER_JOB))
+    with multiprocessing.Pool(args.jobs, initWorker, (allTimes,)) as pool:
+        rows = pool.map(summarizeTask, logs, chunk)
+
+    data = {column: [row[column] for row in rows] for column in COLUMNS}
+    with open(args.output, 'w') as f:
+        json.dump({'columns': COLUMNS, 'rows': len(rows), 'data': data}, f)
+    logger.info('Wrote {} sessions ({} cmds) to {}'.format(
+        len(rows), sum(data['cmds']), args.output))
+    return 0
+
+
+def readAllTimes(dataDir):
+    """
+    Returns {user: [(label, seconds since epoch), ...]} for every user's
+    TIMES_FILE in the given directory.  These are small, so are read up
+    front and handed to every worker.
+    """
+    times = {}
+    for path in glob.glob(os.path.join(dataDir, '*' + TIMES_FILE)):
+        user = os.path.basename(path)[:-len(TIMES_FILE)]
+        if not user.isdigit():
+            continue
+        entries = []
+        with open(path, 'r') as f:
+            for line in f:
+                m = TIMES_LINE.match(line.strip())
+                if m:
+                    entries.append((m.group(1), int(m.group(2))))
+        times[int(user)] = entries
+    return times
+
+
+def initWorker(allTimes):
+    """
+    Sets up a worker process with every user's times, as per readAllTimes().
+    """
+    global times, portUsers, poolStart
+    times = allTimes
+    portUsers = {}
+    for user, entries in times.items():
+        for label, t in entries:
+            if label.startswith('Port=') and label[5:].isdigit():
+                portUsers.setdefault(int(label[5:]), []).append((t, user))
+    for claims in portUsers.values():
+        claims.sort()
+    poolStart = min((claims[0][0] for claims in portUsers.values()),
+                    default=None)
+
+
+def summarizeTask(log):
+    """
+    As summarizeLog(), but returns a row of just the log's name if it could
+    not be read.
+    """
+    try:
+        return summarizeLog(log)
+    except (IOError, UnicodeDecodeError) as e:
+        logger.warning('{}: {}'.format(log, e))
+        row = dict.fromkeys(COLUMNS)
+        row.update(log=os.path.basename(log), cmds=0)
+        return row
+
+
+def summarizeLog(log):
+    """
+    Reads the given session log, and returns its row: {column: value}.
+    """
+    name = os.path.basename(log)
+    m = LOG_NAME.match(name)
+    port, game = int(m.group(1)), m.group(2)
+
+    cmds = 0
+    sizes = []
+    ms = []
+    end = None
+    with open(log, 'r', encoding='utf-8', errors='replace') as f:
+        for line in f:
+            if line.startswith('CMD: ') or line.startswith('<line>'):
+                cmds += 1
+            elif line.startswith('REPLY: '):
+                reply = REPLY_LINE.match(line)
+                if reply:
+                    sizes.append(int(reply.group(1)))
+                    ms.append(int(reply.group(2)))
+                    if reply.group(3):
+                        end = int(reply.group(3))
+    if end is None:
+        end = int(os.path.getmtime(log))
+
+    user = findUser(port, end)
+    start = None
+    if user is not None:
+        before = [t for label, t in times[user] if t <= end]
+        start = before[-1] if before else None
+    seconds = end - start if start is not None else None
+
+    return {
+        'log': name,
+        'user': user,
+        'game': game,
+        'port': port,
+        'cmds': cmds,
+        'start': start,
+        'seconds': seconds,
+        'turnSeconds': seconds / cmds if seconds is not None and cmds else None,
+        'replies': len(sizes),
+        'replyChars': sum(sizes),
+        'maxReplyChars': max(sizes) if sizes else None,
+        'meanReplyMs': statistics.mean(ms) if ms else None,
+        'maxReplyMs': max(ms) if ms else None,
+    }
+
+
+def findUser(port, end):
+    """
+    Returns the user whose session ran on the given port and ended at end,
+    or None if unknown.
+    """
+    claims = [user for t, user in portUsers.get(port, []) if t <= end]
+    if claims:
+        return claims[-1]
+    if poolStart is not None and end >= poolStart:
+        return None  # a pooled port, so says nothing of its user
+    user = port - port % 5  # ports are user + 1 to 4 (see serveGame)
+    return user if user in times else None
+
+
+if __name__ == "__main__":
+    sys.exit(main())
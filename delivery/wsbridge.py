@@ -0,0 +1,186 @@
+#!python3
+
+"""
+Carries a client's Skald requests to a game over one WebSocket, for
+frontend.py.  (The game's own TADS server only speaks plain HTTP.)
+
+Each text message from the client is JSON naming a game endpoint, such as:
+
+  {"type": "cmd", "cmd": "look", "v": 3}
+  {"type": "init"}
+
+which is POSTed to the game as /skald/<type>?v=<v> with the cmd as its
+body.  The game's reply comes back as:
+
+  {"type": "cmd", "status": 200, "html": "..."}
+
+Meanwhile, the bridge keeps a /skald/events request open to the game, so
+anything printed by the game's real-time events is pushed to the client
+as soon as it appears:
+
+  {"type": "output", "status": 200, "html": "..."}
+
+Created: 18 Oct 2026
+"""
+
+import base64
+import hashlib
+import json
+import logging
+import struct
+import threading
+import time
+
+
+logger = logging.getLogger(__name__)
+
+GUID = '258EAFA5-E914-47DA-95CA-C5AB0DC85B11'  # as per RFC 6455
+OP_CONT, OP_TEXT, OP_BINARY, OP_CLOSE, OP_PING, OP_PONG = 0, 1, 2, 8, 9, 10
+MAX_MESSAGE = 1024 * 1024  # bytes
+
+# message types that may be sent on to the game
+TYPES = ['init', 'cmd', 'batch', 'affordances']
+EVENTS_RETRY = 1  # seconds to wait before re-polling events after an error
+
+
+def acceptKey(key):
+    """
+    Returns the Sec-WebSocket-Accept value for the given Sec-WebSocket-Key.
+    """
+    digest = hashlib.sha1((key.strip() + GUID).encode()).digest()
+    return base64.b64encode(digest).decode()
+
+
+class GameSocket:
+    """
+    One client's WebSocket, after the handshake.  forward(path, body) must
+    POST to the game and return (status, data), or raise OSError.
+    """
+
+    def __init__(self, rfile, wfile, forward):
+        self.rfile = rfile
+        self.wfile = wfile
+        self.forward = forward
+        self.open = True
+        self.sendLock = threading.Lock()
+
+    def run(self):
+        """
+        Handles messages until the client closes the socket.
+        """
+        threading.Thread(target=self.pollEvents, daemon=True).start()
+        try:
+            while self.open:
+                message = self.readMessage()
+                if message is None:
+                    break
+                self.handle(message)
+        finally:
+            self.open = False
+
+    def handle(self, message):
+        try:
+            request = json.loads(message)
+            kind = request['type']
+            version = request.get('v')
+            if version is not None:
+                version = int(version)
+        except (ValueError, KeyError, TypeError, AttributeError):
+            self.sendJson({'type': 'error', 'status': 400})
+            return
+        if kind not in TYPES:
+            self.sendJson({'type': kind, 'status': 404})
+            return
+        path = '/skald/' + kind
+        if version is not None:
+            path += '?v=' + str(version)
+        body = request.get('cmd')
+        try:
+            status, data = self.forward(path, body.encode() if body else None)
+        except OSError as e:
+            logger.warning('WebSocket {}: {}'.format(kind, e))
+            self.sendJson({'type': kind, 'status': 502})
+            return
+        self.sendJson({'type': kind, 'status': status, 'html': data.decode()})
+
+    def pollEvents(self):
+        """
+        Relays output from the game's events endpoint while the socket is
+        open.
+        """
+        while self.open:
+            try:
+                status, data = self.forward('/skald/events', None)
+            except OSError:
+                time.sleep(EVENTS_RETRY)
+                continue
+            if status == 200 and self.open:
+                self.sendJson({'type': 'output', 'status': status,
+                               'html': data.decode()})
+            elif status != 204:
+                time.sleep(EVENTS_RETRY)
+
+    def readFrame(self):
+        """
+        Returns (fin, opcode, payload) for the next frame, or None if the
+        connection has closed or the frame is too large.
+        """
+        head = self.rfile.read(2)
+        if len(head) < 2:
+            return None
+        fin, opcode = head[0] & 0x80, head[0] & 0x0F
+        masked, length = head[1] & 0x80, head[1] & 0x7F
+        if length == 126:
+            length = struct.unpack('!H', self.rfile.read(2))[0]
+        elif length == 127:
+            length = struct.unpack('!Q', self.rfile.read(8))[0]
+        if length > MAX_MESSAGE:
+            return None
+        mask = self.rfile.read(4) if masked else None
+        payload = self.rfile.read(length)
+        if mask:
+            payload = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+        return fin, opcode, payload
+
+    def readMessage(self):
+        """
+        Returns the next text message, answering any pings on the way.
+        Returns None once the client closes the socket.
+        """
+        parts = []
+        while True:
+            frame = self.readFrame()
+            if frame is None:
+                return None
+            fin, opcode, payload = frame
+            if opcode == OP_CLOSE:
+                self.send(OP_CLOSE, payload[:2])
+                return None
+            elif opcode == OP_PING:
+                self.send(OP_PONG, payload)
+                continue
+            elif opcode == OP_PONG:
+                continue
+            parts.append(payload)
+            if sum(len(p) for p in parts) > MAX_MESSAGE:
+                return None
+            if fin:
+                return b''.join(parts).decode('utf-8', 'replace')
+
+    def sendJson(self, obj):
+        self.send(OP_TEXT, json.dumps(obj).encode())
+
+    def send(self, opcode, payload):
+        length = len(payload)
+        if length < 126:
+            head = struct.pack('!BB', 0x80 | opcode, length)
+        elif length < 65536:
+            head = struct.pack('!BBH', 0x80 | opcode, 126, length)
+        else:
+            head = struct.pack('!BBQ', 0x80 | opcode, 127, length)
+        with self.sendLock:
+            try:
+                self.wfile.write(head + payload)
+                self.wfile.flush()
+            except OSError:
+                self.open = False
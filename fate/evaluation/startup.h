@@ -18,6 +18,7 @@ replace initUI() {
     local srv = browserGlobals.httpServer = new HTTPServer(
         getLaunchHostAddr(), startup.port, 1024*1024);
     webSession.connectUI(srv);
+    // (connectUI's "connectWebUI:<url>" console line is our ready signal)
 }
 #else
 // skald mode
@@ -45,6 +46,15 @@ startup : object
     // defaults
     port = nil      // mil = system assigned
     logName = nil
+    session = nil   // names this session's saved files; default is logName
+    bench = nil     // true = run in skaldBench mode (see skaldserver.h)
+    local = nil     // true = only accept connections from this machine
+    hibernate = nil // true = save and exit when idle, rather than time out
+    restoreFile = nil // game saved by hibernating, to resume from
+    recoverFile = nil // journal of a game that crashed, to recover from
+    resumed = nil   // true once resumed from restoreFile
+    
+    HIBERNATE_AFTER = 5 * (60 * 1000)  // idle ms before hibernating
    
     
     /*
@@ -56,19 +66,56 @@ startup : object
      *   [1] = name of program
      *   [2] = port to run on
      *
+     *   Either may be followed by -bench to replay commands in benchmark
+     *   mode instead of starting the server, or by -local to serve only to
+     *   this machine (as when behind delivery/frontend.py).  In Skald mode,
+     *   -hibernate saves and exits after HIBERNATE_AFTER idle ms (see 
+     *   skaldServer.hibernate()), -restore <file> resumes the game saved 
+     *   to that file, and -recover <file> recovers the game journaled to 
+     *   that file (see skaldJournal) and carries on its journal.  Also,
+     *   -session <name> names those files (rather than port and game name,
+     *   since ports are reused), and should stay the same when resuming.
+     *   Only a game given a -session is journaled.
+     *
      *   Always logs to a file based on game name, port number, and game mode.
      */
     init() {
         local args = libGlobal.commandLineArgs;
         local progName = args[1];
+        self.bench = (args.indexOf('-bench') != nil);
+        self.local = (args.indexOf('-local') != nil);
+        self.hibernate = (args.indexOf('-hibernate') != nil);
+        args = args.subset({x: x != '-bench' && x != '-local' && x != '-hibernate'});
+        local i = args.indexOf('-restore');
+        if (i != nil) {
+            self.restoreFile = (i < args.length()) ? args[i + 1] : nil;
+            args = args.sublist(1, i - 1) + args.sublist(i + 2);
+        }
+        i = args.indexOf('-session');
+        if (i != nil) {
+            self.session = (i < args.length()) ? args[i + 1] : nil;
+            args = args.sublist(1, i - 1) + args.sublist(i + 2);
+        }
+        i = args.indexOf('-recover');
+        if (i != nil) {
+            self.recoverFile = (i < args.length()) ? args[i + 1] : nil;
+            args = args.sublist(1, i - 1) + args.sublist(i + 2);
+        }
         // will be nil if arg is not an int        
         self.port = (args.length() > 1) ? toInteger(args[2]) : self.port;
         self.logName =  (self.port) ? ('' + self.port + '-' + progName) : nil;
     }
     
+    /* The base name of this session's saved files. */
+    sessionName() {
+        return self.session ? self.session : 
+            (self.logName ? self.logName : 'skald');
+    }
+    
     /*
      *   If running in Skald mode, will initialize skaldServer correctly and
-     *   start it up.  Regardless of model, will start logging.
+     *   start it up, which prints a SKALD-READY line once it is listening.
+     *   Regardless of model, will start logging.
      *
      *   Calls init before anything else.
      */
@@ -80,13 +127,80 @@ startup : object
             }
         #else
             // skald mode
+            if (self.restoreFile) {
+                self.resume();
+            }else if (self.recoverFile) {
+                self.recover();
+            }
             // LogTypes = Transcript: all in/out, Command: only cmd-line in, Script: all input
             if (self.logName) {
                 setLogFile(self.logName + '.log', LogTypeTranscript);
             }
+            if (self.bench) {
+                skaldBench.start();
+                return;
+            }
+            if (self.session && !self.resumed && !self.recoverFile) {
+                // (a resumed game carries on the journal it was saved with;
+                // without a session, there's nothing to recover it)
+                skaldJournal.start(self.sessionName() + '.journal');
+            }
             skaldServer.connectionTimeout = 15 * (60 * 1000);  // ms to minutes 
+            if (self.hibernate) {
+                skaldServer.hibernateTimeout = self.HIBERNATE_AFTER;
+                skaldServer.hibernateFile = self.sessionName() + '.t3v';
+            }
             skaldServer.port = self.port;
+            if (self.local) {
+                skaldServer.hostname = '127.0.0.1';
+            }
             skald.start();  // this time without processed args
         #endif
     }
-;
\ No newline at end of file
+    
+    /*
+     *   Restores the game saved in restoreFile, as when hibernating.  The
+     *   command line args are then reprocessed, since the saved ones are
+     *   those of the run that hibernated.  Sets resumed, so that newGame()
+     *   carries on rather than starting over (see GameMainDef below).
+     */
+    resume() {
+        local args = libGlobal.commandLineArgs;
+        restoreGame(self.restoreFile);
+        libGlobal.commandLineArgs = args;
+        PostRestoreObject.restoreCode = 2;  // as for a restore at startup
+        PostRestoreObject.classExec();
+        self.init();
+        self.resumed = true;
+    }
+    
+    /*
+     *   Recovers the game journaled to recoverFile, from its last snapshot 
+     *   (if it has one) followed by the cmds journaled since.
+     */
+    recover() {
+        local snapshot = skaldJournal.lastSnapshot(self.recoverFile);
+        if (snapshot != nil) {
+            self.restoreFile = snapshot;
+            self.resume();
+        }
+        skaldJournal.recover(self.recoverFile);
+    }
+;
+
+#ifndef TEXT_MODE
+/*
+ *   When resuming a saved game, skips the intro and carries on from where
+ *   it left off.  (The game's own newGame() should call startup.start()
+ *   first, then inherited().)
+ */
+modify GameMainDef
+    newGame() {
+        if (startup.resumed) {
+            runGame(nil);
+        }else {
+            inherited();
+        }
+    }
+;
+#endif
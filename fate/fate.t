@@ -73,6 +73,9 @@ skald: SkaldUI
 
         TravelDirAction -> [4010, 'Go']
     ]
+
+    // GiveTo's dobj verify (below) depends on gIobj
+    unprunedVerbs = [GiveToAction]
 ;
 
 modify Thing {
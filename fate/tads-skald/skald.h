@@ -145,10 +145,104 @@ class SkaldUI: object
                      defaultWestWall, defaultNorthWall, defaultEastWall,
                      defaultSouthWall]
     
+    /*
+     *   When true, getAffordances() keeps the verify results from the previous
+     *   call and only re-verifies the (verb, dobj, iobj) cells whose objects
+     *   entered scope or changed state since then.  An object has changed
+     *   state if any of its affordanceStateProps differ.  If the player
+     *   character moves or the lighting of its location changes, everything is
+     *   re-verified.
+     *
+     *   verify() handlers can depend on state that is not captured by
+     *   affordanceStateProps, so this is off by default.  If you turn it on,
+     *   add any such properties to affordanceStateProps or call
+     *   invalidateAffordances() after those changes.
+     */
+    INCREMENTAL_AFFORDANCES = nil
+    
+    /*
+     *   The properties that make up an object's state for the purposes of
+     *   INCREMENTAL_AFFORDANCES.  These are read from every object in scope
+     *   each turn, so they should not be methods with side-effects.
+     */
+    affordanceStateProps = [&location, &isOpen, &isLocked, &isOn, &isLit,
+                            &wornBy, &curState]
+    
+    /*
+     *   TIActions with a dobj or iobj verify() handler that depends on the
+     *   other object (such as through gIobj or gDobj).  Normally,
+     *   getAffordances() first verifies each dobj and iobj on its own and only
+     *   verifies the pairs made from the survivors.  Verbs listed here skip
+     *   that pruning and have every pair verified.
+     */
+    unprunedVerbs = []
+    
+    /*
+     *   When true, footers are versioned and, once the client has a footer,
+     *   only carry the affordances and objects that changed since then.  The
+     *   client must send back the version it last received.  See getFooter()
+     *   and DESIGN.txt.
+     */
+    DELTA_FOOTER = nil
+    
+    /*
+     *   When true, footers list each object name and verb only once, in an
+     *   object table and a verb table, and affordances refer to them by index.
+     *   With DELTA_FOOTER, the tables persist for as long as the client keeps
+     *   up, and each footer only sends new entries.  See getFooter() and
+     *   DESIGN.txt.
+     */
+    COMPACT_FOOTER = nil
+    
+    /* COMPACT_FOOTER tables: index -> name/verb and name/verb -> index */
+    objectTable_ = nil
+    objectIds_ = nil
+    verbTable_ = nil
+    verbIds_ = nil
+    /* number of table entries already sent to the client */
+    objectsSent_ = 0
+    verbsSent_ = 0
+    
+    /* objectsFilter as a table; see getFilterSet() */
+    filterSet_ = nil
+    /* this turn's getObjectsInScope(), and who and where it was computed for */
+    scopeCache_ = nil
+    scopeActor_ = nil
+    scopeLocation_ = nil
+    
+    /* writer reused by getJsonWriter() */
+    jsonWriter_ = nil
+    
+    /* version number of the last footer sent */
+    footerVersion_ = 0
+    /* affordance and object name strings in the last footer sent */
+    sentAffs_ = nil
+    sentObjs_ = nil
+    
+    /* cached verify results: verb -> dobj -> result (or -> iobj -> result) */
+    affCache_ = nil
+    /* obj -> state signature, as of the last getAffordances() */
+    objStates_ = nil
+    /* objects whose cells must be re-verified during this getAffordances() */
+    dirtyObjs_ = nil
+    /* player/location/lighting state the cache was built in */
+    affContext_ = nil
+    
+    /*
+     *   When true, skaldProfiler records where the time goes while building
+     *   each reply: time spent on scope, exits, topics, verify() and
+     *   serialization, verify() calls and time per verb, and the slowest
+     *   verify() calls.  The last reply's profile is printed by the
+     *   affordances command and served (as JSON) at skaldServer.MODULE +
+     *   'profile'.
+     */
+    PROFILE_AFFORDANCES = nil
+    
     /* 
      *   Starts the server and performs other setup work.
      */
     start() {
+        self.buildFilterSet();
         skaldServer.start();
         exitsMode.inRoomDesc = self.EXITS_LOOK;
     }
@@ -207,20 +301,35 @@ class SkaldUI: object
      *   gameworld state.
      */
     getAffordances() {
-        local affs = [];        
+        local w = self.getJsonWriter();
+        self.writeAffordances(w, self.getAffordanceList());
+        return w.getJson();
+    }
+    
+    /*
+     *   As getAffordances(), but returns a list of the individual affordances,
+     *   each of which is a [verb, dobj, iobj, weak] list of the arguments to
+     *   toJsonAffordance().
+     */
+    getAffordanceList() {
+        local affs = new Vector(50);
+        if (skald.COMPACT_FOOTER && skald.objectTable_ == nil) {
+            skald.resetTables();
+        }
+        skald.updateDirtyObjects(skald.getObjectsInScope());
         foreach (local verb in skald.verbNames.keysToList()) {
             if (!verb.ofKind(TAction)) {
                 // special handling for travel actions
                 if (verb == TravelDirAction) {
                     local dirNames = skald.getExits().mapAll({x : x.name});
-                    affs += skald.toJsonAffordance(verb, dirNames, nil, nil);
+                    affs.append([verb, dirNames, nil, nil]);
                     continue; //done with this verb
                 }
                 
                 //only an IAction with no objects
                 local verified = skald.isAfforded(gPlayerChar, verb, nil, nil);
                 if (verified) {
-                    affs += skald.toJsonAffordance(verb, nil, nil, verified < 0);
+                    affs.append([verb, nil, nil, verified < 0]);
                 }
                 
             }else if (verb.ofKind(TopicTAction)) {
@@ -229,7 +338,7 @@ class SkaldUI: object
                 foreach (local dobj in dobjs) {
                     local topics = skald.getTopics(dobj, verb);
                     if (topics && topics.length() > 0) {
-                        affs += skald.toJsonAffordance(verb, dobj, topics, nil);
+                        affs.append([verb, dobj, topics, nil]);
                     }
                 }
                 
@@ -239,7 +348,7 @@ class SkaldUI: object
                 local strong = [];
                 local weak = [];                    
                 foreach (local dobj in dobjs) {
-                    local verified = skald.isAfforded(gPlayerChar, verb, dobj, nil);
+                    local verified = skald.checkAfforded(verb, dobj, nil);
                     if (verified > 0) {
                         strong += dobj;
                     }else if (verified < 0){
@@ -247,38 +356,145 @@ class SkaldUI: object
                     }
                 }
                 if (strong.length() > 0) {
-                    affs += skald.toJsonAffordance(verb, strong, nil, nil);
+                    affs.append([verb, strong, nil, nil]);
                 }
                 if (weak.length() > 0) {
-                    affs += skald.toJsonAffordance(verb, weak, nil, true);
+                    affs.append([verb, weak, nil, true]);
                 }               
             }else { //TIaction
                 local dobjs = skald.getObjectsInScope();
                 local iobjs = dobjs;  //actually the same list
+                if (skald.unprunedVerbs.indexOf(verb) == nil) {
+                    // drop objects that can't fill their role with any partner
+                    dobjs = dobjs.subset(
+                        {x: skald.isRoleAfforded(gPlayerChar, verb, x, DirectObject)});
+                    iobjs = iobjs.subset(
+                        {x: skald.isRoleAfforded(gPlayerChar, verb, x, IndirectObject)});
+                }
+                // dobjs afforded with the same iobjs share a single affordance
+                local groups = new LookupTable();
+                local groupKeys = new Vector(10);
                 foreach (local dobj in dobjs) {
                     local strong = [];
                     local weak = [];                    
                     foreach (local iobj in iobjs) {
-                        local verified = skald.isAfforded(gPlayerChar, verb, dobj, iobj);
+                        local verified = skald.checkAfforded(verb, dobj, iobj);
                         if (verified > 0) {
                             strong += iobj;
                         }else if (verified < 0){
                             weak += iobj;
                         }
                     }
-                    //XXX: if only one iobj element in strong+weak, could be compacted
-                    //with all dobjs, rather than having each dobj separate. Hard to
-                    //do here, so will leave this for a later optimization.
                     if (strong.length() > 0) {
-                        affs += skald.toJsonAffordance(verb, dobj, strong, nil);
+                        skald.addToGroup(groups, groupKeys, dobj, strong, nil);
                     }
                     if (weak.length() > 0) {
-                        affs += skald.toJsonAffordance(verb, dobj, weak, true);
+                        skald.addToGroup(groups, groupKeys, dobj, weak, true);
                     }
-                }                
+                }
+                foreach (local key in groupKeys) {
+                    local group = groups[key];
+                    affs.append([verb, group[1], group[2], group[3]]);
+                }
             }
         }         
-        return toJsonList(affs, true);
+        return affs.toList();
+    }
+    
+    /*
+     *   Adds dobj to the [dobjs, iobjs, weak] group in groups for the given
+     *   iobjs and weakness, creating the group (and recording its key in
+     *   groupKeys, to preserve ordering) if this is the first such dobj.
+     *   Groups are keyed by the iobjs themselves, not their names, so that
+     *   different objects that happen to share a name are kept apart.
+     */
+    addToGroup(groups, groupKeys, dobj, iobjs, weak) {
+        local key = [weak] + iobjs;
+        local group = groups[key];
+        if (group == nil) {
+            groups[key] = [[dobj], iobjs, weak];
+            groupKeys.append(key);
+        }else {
+            groups[key] = [group[1] + dobj, iobjs, weak];
+        }
+    }
+    
+    /*
+     *   Compares the current state of the given objects (normally everything
+     *   in scope) against the state recorded by the last call and marks those
+     *   that differ as dirty for checkAfforded().  Objects that have left
+     *   scope are forgotten, so they will be dirty if they come back.
+     *
+     *   Flushes all cached results if the player's location or its lighting
+     *   has changed.  Does nothing if INCREMENTAL_AFFORDANCES is off.
+     */
+    updateDirtyObjects(objs) {
+        if (!self.INCREMENTAL_AFFORDANCES) {
+            return;
+        }
+        local loc = gPlayerChar.location;
+        local context = [gPlayerChar, loc, loc && loc.wouldBeLitFor(gPlayerChar)];
+        if (context != self.affContext_) {
+            self.affCache_ = new LookupTable();
+            self.objStates_ = new LookupTable();
+            self.affContext_ = context;
+        }
+        
+        local states = new LookupTable();
+        self.dirtyObjs_ = new LookupTable();
+        foreach (local obj in objs) {
+            local state = self.affordanceStateProps.mapAll({p: obj.(p)});
+            if (self.objStates_[obj] != state) {
+                self.dirtyObjs_[obj] = true;
+            }
+            states[obj] = state;
+        }
+        self.objStates_ = states;
+    }
+    
+    /*
+     *   Forces the next getAffordances() to re-verify everything.  Use this
+     *   with INCREMENTAL_AFFORDANCES after a state change that verify()
+     *   handlers depend on but affordanceStateProps does not cover.
+     */
+    invalidateAffordances() {
+        self.affContext_ = nil;
+    }
+    
+    /*
+     *   As isAfforded(gPlayerChar, verb, dobj, iobj), but if
+     *   INCREMENTAL_AFFORDANCES is on, reuses the last result for this cell
+     *   unless dobj or iobj was marked dirty by updateDirtyObjects().
+     */
+    checkAfforded(verb, dobj, iobj) {
+        if (!self.INCREMENTAL_AFFORDANCES) {
+            return self.isAfforded(gPlayerChar, verb, dobj, iobj);
+        }
+        
+        local cells = self.affCache_[verb];
+        if (cells == nil) {
+            cells = new LookupTable();
+            self.affCache_[verb] = cells;
+        }
+        local key = dobj;
+        if (iobj != nil) {
+            //TIAction: a row of iobj results for each dobj
+            local row = cells[dobj];
+            if (row == nil) {
+                row = new LookupTable();
+                cells[dobj] = row;
+            }
+            cells = row;
+            key = iobj;
+        }
+        
+        if (!self.dirtyObjs_[dobj] && !(iobj && self.dirtyObjs_[iobj]) &&
+            cells.isKeyPresent(key)) {
+            return cells[key];
+        }
+        local verified = self.isAfforded(gPlayerChar, verb, dobj, iobj);
+        cells[key] = verified;
+        return verified;
     }
     
     /*
@@ -291,12 +507,158 @@ class SkaldUI: object
     /*
      *   Return the appropriate footer, including current affordances, for a
      *   response to the client.
+     *
+     *   If DELTA_FOOTER is on, every footer is numbered with a "version".  If
+     *   baseVersion is the version of the last footer sent, the footer gives
+     *   only the affordances and objects added or removed since then.
+     *   Otherwise (such as for an init request), the full lists are sent.
+     *
+     *   If COMPACT_FOOTER is on, the footer also carries any new entries for
+     *   the client's object and verb tables.  These tables start over with
+     *   every full footer.
+     */
+    getFooter(baseVersion?) {
+        local delta = self.DELTA_FOOTER && baseVersion != nil && 
+            baseVersion == self.footerVersion_ && self.sentAffs_ != nil;
+        if (self.COMPACT_FOOTER && !delta) {
+            self.resetTables();
+        }
+        
+        local affs = self.getAffordanceList();
+        local objs = self.getObjectList();
+        local t = skaldProfiler.start();
+        local w = self.getJsonWriter();
+        w.write('\n<script class="footer">');
+        w.beginObject();
+        if (self.DELTA_FOOTER) {
+            // need each affordance on its own to compare with the next footer
+            affs = affs.mapAll({a: self.toJsonAffordance(a[1], a[2], a[3], a[4])});
+            w.key('version');
+            w.value(self.footerVersion_ + 1);
+        }
+        if (delta) {
+            w.key('base');
+            w.value(baseVersion);
+            w.lineSep();
+            w.key('affordances');
+            self.writeDelta(w, self.sentAffs_, affs, true);
+            w.lineSep();
+            w.key('objects');
+            self.writeDelta(w, self.sentObjs_, objs);
+        }else {
+            w.key('affordances');
+            if (self.DELTA_FOOTER) {
+                w.value(affs, true);
+            }else {
+                self.writeAffordances(w, affs);
+            }
+            w.lineSep();
+            w.key('objects');
+            w.value(objs);
+        }
+        self.writeTables(w);
+        w.endObject();
+        w.write('</script>\n');
+        
+        if (self.DELTA_FOOTER) {
+            self.footerVersion_++;
+            self.sentAffs_ = affs;
+            self.sentObjs_ = objs;
+        }
+        skaldProfiler.addTime('serialize', t);
+        return w.getJson();
+    }
+    
+    /*
+     *   Returns this UI's JSON writer, emptied and ready for use.  The same
+     *   writer (and its buffer) is reused each time, so the caller should be
+     *   done with its contents before this is called again.
+     */
+    getJsonWriter() {
+        if (self.jsonWriter_ == nil) {
+            self.jsonWriter_ = new SkaldJsonWriter();
+        }
+        self.jsonWriter_.reset();
+        self.jsonWriter_.spaced = !self.COMPACT_FOOTER;
+        return self.jsonWriter_;
+    }
+    
+    /*
+     *   Returns the objects in scope as they are listed in a footer: their
+     *   names or, if COMPACT_FOOTER is on, their object table indexes.
+     */
+    getObjectList() {
+        local objs = self.getObjectsInScope();
+        return (self.COMPACT_FOOTER) ? self.internObjects(objs) : 
+                                       objs.mapAll({obj: obj.name});
+    }
+    
+    /*
+     *   Empties the COMPACT_FOOTER object and verb tables.
+     */
+    resetTables() {
+        self.objectTable_ = new Vector(50);
+        self.objectIds_ = new LookupTable();
+        self.verbTable_ = new Vector(20);
+        self.verbIds_ = new LookupTable();
+        self.objectsSent_ = 0;
+        self.verbsSent_ = 0;
+    }
+    
+    /*
+     *   Returns the index of the given verb in the COMPACT_FOOTER verb table,
+     *   adding it if necessary.  Indexes start at 0.
+     */
+    internVerb(verb) {
+        local id = self.verbIds_[verb];
+        if (id == nil) {
+            id = self.verbTable_.length();
+            self.verbTable_.append(verb);
+            self.verbIds_[verb] = id;
+        }
+        return id;
+    }
+    
+    /*
+     *   Returns a list of the object table indexes for objs, which may be a
+     *   single object or string or a list of them (as per toJsonList).  Names
+     *   not yet in the table are added.  Indexes start at 0.
+     */
+    internObjects(objs) {
+        if (!objs.ofKind(List)) {
+            objs = [objs];
+        }
+        return objs.mapAll(new function(obj) {
+            local name = (obj.ofKind(String)) ? obj : obj.name;
+            local id = self.objectIds_[name];
+            if (id == nil) {
+                id = self.objectTable_.length();
+                self.objectTable_.append(name);
+                self.objectIds_[name] = id;
+            }
+            return id;
+        });
+    }
+    
+    /*
+     *   Writes the object and verb table entries added since the last call as
+     *   "objectTable" and "verbTable" fields of the JSON object currently
+     *   open in writer w.  Each verb entry is [order, "name"] or [order,
+     *   "name", "preposition"].  Does nothing if COMPACT_FOOTER is off.
      */
-    getFooter() {
-        return '\n<script class="footer">{"affordances": ' + 
-            self.getAffordances() + ',\n"objects": ' +
-            self.toJsonList(self.getObjectsInScope()) +
-            '}</script>\n';
+    writeTables(w) {
+        if (!self.COMPACT_FOOTER) {
+            return;
+        }
+        w.lineSep();
+        w.key('objectTable');
+        w.value(self.objectTable_.toList(self.objectsSent_ + 1));
+        w.lineSep();
+        w.key('verbTable');
+        w.value(self.verbTable_.toList(self.verbsSent_ + 1).mapAll(
+            {v: self.verbNames[v]}));
+        self.objectsSent_ = self.objectTable_.length();
+        self.verbsSent_ = self.verbTable_.length();
     }
     
     /*
@@ -313,13 +675,23 @@ class SkaldUI: object
             '\n<script class="footer">{"gameOver": true}</script>\n';
     }
     
+    /*
+     *   Returns a footer that has no affordances or objects, but says that
+     *   they will be available separately.  See skaldServer.SPLIT_REPLY.
+     */
+    getPendingFooter() {
+        return '\n<script class="footer">{"affordancesPending": true}</script>\n';
+    }
+    
     /*
      *   Returns the current directions that point to obvious exits, according
      *   to TADS's normal exit detection logic.
      */
     getExits() {
+        local t = skaldProfiler.start();
         exitLister.showExitsWithLister(gPlayerChar, gPlayerChar.location, 
                 skaldExitLister, gPlayerChar.location.wouldBeLitFor(gPlayerChar));
+        skaldProfiler.addTime('exits', t);
         return skaldExitLister.getList();
     }
     
@@ -329,18 +701,61 @@ class SkaldUI: object
      *   and adds objects in accordance with objectsFilter and
      *   IGNORE_ROOM_AS_OBJECT.  Also drops any objects that have no
      *   name.
+     *
+     *   The list is computed once per turn (see newTurn) and then reused, as
+     *   long as the player character is still in the same location.
      */
     getObjectsInScope() {
-        local objects = libGlobal.playerChar.scopeList();
-        //filter out those objects in filterObjects
-        objects = objects.subset({x: self.objectsFilter.indexOf(x) == nil});
-        if (self.IGNORE_ROOM_AS_OBJECT && objects.indexOf(gPlayerChar.location)) {
-            //may not be there if in the dark
-            objects = objects.removeElementAt(objects.indexOf(gPlayerChar.location));
-        }
-        objects = objects.subset({x: x.name != nil && x.name.length() > 0});
+        local loc = gPlayerChar.location;
+        if (self.scopeCache_ != nil && self.scopeActor_ == gPlayerChar && 
+            self.scopeLocation_ == loc) {
+            return self.scopeCache_;
+        }
+        
+        local t = skaldProfiler.start();
+        local filter = self.getFilterSet();
+        //room may not be in scope anyway if in the dark
+        local room = (self.IGNORE_ROOM_AS_OBJECT) ? loc : nil;
+        local objects = libGlobal.playerChar.scopeList().subset(
+            {x: !filter.isKeyPresent(x) && (room == nil || x != room) &&
+                x.name != nil && x.name.length() > 0});
+        
+        self.scopeCache_ = objects;
+        self.scopeActor_ = gPlayerChar;
+        self.scopeLocation_ = loc;
+        skaldProfiler.addTime('scope', t);
         return objects;
     }
+    
+    /*
+     *   Returns objectsFilter as a LookupTable of obj -> true.  This is built
+     *   by start() (or the first time it is needed), so changes to
+     *   objectsFilter after that must be followed by another call to
+     *   buildFilterSet().
+     */
+    getFilterSet() {
+        if (self.filterSet_ == nil) {
+            self.buildFilterSet();
+        }
+        return self.filterSet_;
+    }
+    
+    /* Rebuilds the table returned by getFilterSet() from objectsFilter. */
+    buildFilterSet() {
+        self.filterSet_ = new LookupTable();
+        foreach (local obj in self.objectsFilter) {
+            self.filterSet_[obj] = true;
+        }
+    }
+    
+    /*
+     *   Forgets results that are only good for a single turn, such as the
+     *   getObjectsInScope() list.  This is called just before the game prompts
+     *   for each new command, after the last turn (and its daemons) are done.
+     */
+    newTurn() {
+        self.scopeCache_ = nil;
+    }
 
     /* 
      *   As getObjectsInScope(), but returns a list of the .name of the object.
@@ -366,6 +781,7 @@ class SkaldUI: object
         if (!npc || !npc.ofKind(Actor)) {
             return topics;   
         }        
+        local t = skaldProfiler.start();
         switch (verb) {
         case AskAboutAction:
             topics += npc.askTopics;
@@ -399,6 +815,7 @@ class SkaldUI: object
         if (!asObjs) {
             topics = topics.mapAll({x: x.name});
         }
+        skaldProfiler.addTime('topics', t);
         return topics;
     }
     
@@ -466,8 +883,59 @@ class SkaldUI: object
         gAction = action;
         gActor = actor;
         
+        local t = skaldProfiler.start();
         local results = action.verifyAction();
+        skaldProfiler.addVerify(action, dobj, iobj, t);
+        return self.rankVerifyResults(results);
+    }
+    
+    /*
+     *   Returns whether obj could fill the given role (DirectObject or
+     *   IndirectObject) of the TIAction action for some partner object.  Only
+     *   obj's own verify() handler for that role is run, with the other
+     *   object left as nil.  
+     *
+     *   Returns nil if the handler rules obj out (isAfforded() == 0).  If the
+     *   handler fails because it needs the other object, obj cannot be ruled 
+     *   out, so returns true.  Used to prune the dobj x iobj cross product; 
+     *   see unprunedVerbs.
+     */
+    isRoleAfforded(actor, action, obj, role) {
+        local isDobj = (role == DirectObject);
+        action.actor_ = actor;
+        action.dobjCur_ = (isDobj) ? obj : nil;
+        action.iobjCur_ = (isDobj) ? nil : obj;
+        action.tentativeDobj_ = (isDobj) ? [obj] : [];
+        action.tentativeIobj_ = (isDobj) ? [] : [obj];
         
+        gAction = action;
+        gActor = actor;
+        
+        local results;
+        local t = skaldProfiler.start();
+        try {
+            if (isDobj) {
+                results = action.callVerifyProp(obj, action.verDobjProp, 
+                    action.preCondDobjProp, action.remapDobjProp, nil, role);
+            }else {
+                results = action.callVerifyProp(obj, action.verIobjProp, 
+                    action.preCondIobjProp, action.remapIobjProp, nil, role);
+            }
+        }
+        catch (RuntimeError err) {
+            return true;  //probably needed the other object
+        }
+        finally {
+            skaldProfiler.addVerify(action, action.dobjCur_, action.iobjCur_, t);
+        }
+        return self.rankVerifyResults(results) != 0;
+    }
+    
+    /*
+     *   Converts a VerifyResultList (or nil, if no objections) into an
+     *   isAfforded() ranking.
+     */
+    rankVerifyResults(results) {
         if (!results) {
             return 1; //no objections to the command
         }
@@ -494,30 +962,115 @@ class SkaldUI: object
      *   If weak is not nil, will add "weak": true to the affordance.
      */
     toJsonAffordance(verb, dobj, iobj, weak) {
-        local json = '{"affordance": ["' + self.verbNames[verb][2] + '"';
+        local w = new SkaldJsonWriter(!self.COMPACT_FOOTER);
+        self.writeAffordance(w, verb, dobj, iobj, weak);
+        return w.getJson();
+    }
+    
+    /*
+     *   Writes the given list of [verb, dobj, iobj, weak] affordances (see
+     *   getAffordanceList) to writer w as a JSON list, one per line.
+     */
+    writeAffordances(w, affs) {
+        w.beginList();
+        foreach (local aff in affs) {
+            w.lineSep();
+            self.writeAffordance(w, aff[1], aff[2], aff[3], aff[4]);
+        }
+        w.endList();
+    }
+    
+    /*
+     *   Writes the given affordance to writer w, as per toJsonAffordance().
+     *
+     *   If COMPACT_FOOTER is on, writes [verb, weak, [dobjs], [iobjs]]
+     *   instead, where verb and the objects are table indexes (see
+     *   writeTables) and weak is 1 or 0.  The object lists are omitted if not
+     *   given.  The verb table entry supplies the order and preposition.
+     */
+    writeAffordance(w, verb, dobj, iobj, weak) {
+        if (self.COMPACT_FOOTER) {
+            w.beginList();
+            w.value(self.internVerb(verb));
+            w.value((weak) ? 1 : 0);
+            if (dobj) {
+                w.value(self.internObjects(dobj));
+            }
+            if (iobj) {
+                w.value(self.internObjects(iobj));
+            }
+            w.endList();
+            return;
+        }
+        
+        w.beginObject();
+        w.key('affordance');
+        w.beginList();
+        w.value(self.verbNames[verb][2]);
         if (dobj) {
-            json += ', ' + self.toJsonList(dobj);
+            self.writeNames(w, dobj);
         }
         if (iobj) {
             if (skald.getVerbArity(verb) >= 3) {
                //add preposition
-               json += ', "' + self.verbNames[verb][3] + '"';
+               w.value(self.verbNames[verb][3]);
             }
-            json += ', ' + self.toJsonList(iobj);
+            self.writeNames(w, iobj);
         }
-        json += ']';  //end affordances: []
+        w.endList();  //end affordances: []
         if (weak) {
-            json += ', "weak": true';
+            w.key('weak');
+            w.value(true);
+        }
+        w.key('order');
+        w.value(self.verbNames[verb][1]);
+        w.endObject();
+    }
+    
+    /*
+     *   Writes a JSON {"added": [...], "removed": [...]} object of the
+     *   values that are in newList but not oldList and vice versa to writer
+     *   w.  If jsonObj is true, the values are strings of already-formatted
+     *   {json objects} (see toJsonList).
+     */
+    writeDelta(w, oldList, newList, jsonObj?) {
+        local oldSet = new LookupTable();
+        local newSet = new LookupTable();
+        oldList.forEach({x: oldSet[x] = true});
+        newList.forEach({x: newSet[x] = true});
+        local added = newList.subset({x: !oldSet.isKeyPresent(x)});
+        local removed = oldList.subset({x: !newSet.isKeyPresent(x)});
+        
+        w.beginObject();
+        w.key('added');
+        w.value(added, jsonObj);
+        w.key('removed');
+        w.value(removed, jsonObj);
+        w.endObject();
+    }
+    
+    /*
+     *   Writes objs to writer w as a JSON list of names, as per toJsonList().
+     */
+    writeNames(w, objs) {
+        if (!objs.ofKind(List)) {
+            objs = [objs];
         }
-        json += ', "order": ' + self.verbNames[verb][1];
-        json += '}';
-        return json;
+        w.beginList();
+        foreach (local obj in objs) {
+            if (dataType(obj) == TypeObject && !obj.ofKind(String)) {
+                obj = obj.name;
+            }
+            w.value(obj);
+        }
+        w.endList();
     }
     
     /*
      *   Converts objs to a JSON list format.  If objs is a list, grabs .name
      *   for each of its elements.  If not a list, throws objs into a list of a
-     *   single element and does the same thing.  Will handle Strings too. 
+     *   single element and does the same thing.  Will handle Strings and
+     *   integers too. 
      * 
      *   If jsonObj is true, objs already contains {json objects}, so does not
      *   wrap each obj in "quotes" and adds a newline after each comma.
@@ -525,18 +1078,352 @@ class SkaldUI: object
      *   If objs is an empty list, returns an empty list: '[]'.
      */
     toJsonList(objs, jsonObj?) {
-        local sep = (jsonObj) ? ',\n' : '", "';
+        local w = new SkaldJsonWriter(!self.COMPACT_FOOTER);
         if (!objs.ofKind(List)) {
             objs = [objs];
         }
-        if (objs.length() == 0) {
-            return '[]';
+        if (jsonObj) {
+            w.value(objs, true);
+        }else {
+            self.writeNames(w, objs);
         }
-        if (!objs[1].ofKind(String)) {
-            objs = objs.mapAll({o: o.name}); //convert to object names
+        return w.getJson();
+    }
+;
+
+/*
+ *   Writes JSON into a single StringBuffer, so that building a large reply
+ *   (such as the footer) only costs as much as the text produced.  Commas
+ *   are added between values automatically.  Strings are escaped.
+ *
+ *   Example:  
+ *
+ *      local w = new SkaldJsonWriter();
+ *      w.beginObject();
+ *      w.key('objects');
+ *      w.value(['coin', 'menu']);
+ *      w.endObject();
+ *      w.getJson();   // {"objects": ["coin", "menu"]}
+ */
+class SkaldJsonWriter: object
+    
+    /* If true, adds a space after each , and :.  Newlines are unaffected. */
+    spaced = true
+    
+    buffer_ = nil
+    needComma_ = nil  //whether the next value must be preceded by a comma
+    
+    construct(spaced = true) {
+        self.spaced = spaced;
+        self.buffer_ = new StringBuffer(2048, 1024);
+    }
+    
+    /* Empties this writer so it can be used again. */
+    reset() {
+        self.buffer_.deleteChars(1);  //clear all
+        self.needComma_ = nil;
+    }
+    
+    /* Returns everything written so far. */
+    getJson() {
+        return toString(self.buffer_);
+    }
+    
+    /* Writes the given text as is, such as for content around the JSON. */
+    write(txt) {
+        self.buffer_.append(txt);
+    }
+    
+    beginObject() {
+        self.sep();
+        self.buffer_.append('{');
+        self.needComma_ = nil;
+    }
+    
+    endObject() {
+        self.buffer_.append('}');
+        self.needComma_ = true;
+    }
+    
+    beginList() {
+        self.sep();
+        self.buffer_.append('[');
+        self.needComma_ = nil;
+    }
+    
+    endList() {
+        self.buffer_.append(']');
+        self.needComma_ = true;
+    }
+    
+    /* Writes the name of the next field of the current object. */
+    key(name) {
+        self.sep();
+        self.writeString(name);
+        self.buffer_.append((self.spaced) ? ': ' : ':');
+        self.needComma_ = nil;
+    }
+    
+    /*
+     *   Writes the given value: a string, integer, true or nil (as null), or a
+     *   List or Vector of these.  Any other object is written as a string.  
+     * 
+     *   If raw is true, val is (or is a list of) strings of JSON that have
+     *   already been formatted, which are written as is.  Such lists are
+     *   written with each element on its own line.
+     */
+    value(val, raw?) {
+        switch (dataType(val)) {
+        case TypeInt:
+            self.sep();
+            self.buffer_.append(toString(val));
+            break;
+        case TypeTrue:
+            self.sep();
+            self.buffer_.append('true');
+            break;
+        case TypeNil:
+            self.sep();
+            self.buffer_.append('null');
+            break;
+        case TypeList:
+            self.beginList();
+            foreach (local x in val) {
+                if (raw) {
+                    self.lineSep();
+                }
+                self.value(x, raw);
+            }
+            self.endList();
+            return;
+        case TypeObject:
+            if (val.ofKind(Vector)) {
+                self.value(val.toList(), raw);
+                return;
+            }
+            //else fall through to be written as a string
+        default:
+            self.sep();
+            if (raw) {
+                self.buffer_.append(val);
+            }else {
+                self.writeString(toString(val));
+            }
+        }
+        self.needComma_ = true;
+    }
+    
+    /* 
+     *   If a comma is needed before the next value, writes one followed by a
+     *   newline.  Use this before a value (or key) to start it on a new line.
+     */
+    lineSep() {
+        if (self.needComma_) {
+            self.buffer_.append((self.spaced) ? ',\n' : ',');
         }
-        local json = objs.join(sep);
-        return (jsonObj) ? '[' + json + ']' : '["' + json + '"]';
+        self.needComma_ = nil;
+    }
+    
+    /* Writes a comma if one is needed before the next value. */
+    sep() {
+        if (self.needComma_) {
+            self.buffer_.append((self.spaced) ? ', ' : ',');
+        }
+    }
+    
+    /* Writes str as a quoted JSON string. */
+    writeString(str) {
+        self.buffer_.append('"');
+        // < is escaped so that a string can never close the <script> tag
+        str = str.findReplace(
+            ['\\', '"', '\n', '\u000D', '\t', '<'],
+            ['\\\\', '\\"', '\\n', '\\r', '\\t', '\\u003c']);
+        if (rexSearch(self.controlPat_, str) != nil) {
+            // any other control chars, which JSON does not allow as is
+            str = rexReplace(self.controlPat_, str, new function(m, idx, orig) {
+                local hex = toString(m.toUnicode(1), 16);
+                return '\\u00' + ((hex.length() < 2) ? '0' + hex : hex);
+            }, ReplaceAll);
+        }
+        self.buffer_.append(str);
+        self.buffer_.append('"');
+    }
+    
+    controlPat_ = static new RexPattern('[\u0000-\u001F]')
+;
+
+/*
+ *   The timings recorded by skaldProfiler for a single reply.  All times are
+ *   in ms.
+ */
+class SkaldProfile: object
+    startTime = 0
+    totalMs = 0
+    phaseMs = nil    //phase name ('scope', 'verify', etc) -> ms
+    verbStats = nil  //verb -> [verify calls, ms]
+    slowest = nil    //[ms, verb, dobj, iobj] of the slowest verify calls, slowest first
+    
+    construct() {
+        self.startTime = getTime(GetTimeTicks);
+        self.phaseMs = new LookupTable();
+        self.verbStats = new LookupTable();
+        self.slowest = [];
+    }
+;
+
+/*
+ *   Records where the time goes while building a reply, if 
+ *   skald.PROFILE_AFFORDANCES is on.  
+ *
+ *   To time something, get a start time from start() and pass it to 
+ *   addTime() (or addVerify()) when done.  When profiling is off or no 
+ *   reply is being built, start() returns nil and nothing is recorded.
+ *
+ *   Timing uses the interpreter's millisecond clock, so individual verify()
+ *   calls will often register as 0 ms; the per-verb totals are more telling.
+ */
+skaldProfiler: object
+    
+    /* How many of the slowest verify() calls to keep. */
+    MAX_SLOWEST = 10
+    
+    current_ = nil  //profile of the reply being built
+    last_ = nil     //profile of the last complete reply
+    
+    /* Starts profiling a new reply, if profiling is on. */
+    beginReply() {
+        self.current_ = (skald.PROFILE_AFFORDANCES) ? new SkaldProfile() : nil;
+    }
+    
+    /* Finishes profiling the current reply, which becomes the last reply. */
+    endReply() {
+        if (self.current_) {
+            self.current_.totalMs = getTime(GetTimeTicks) - self.current_.startTime;
+            self.last_ = self.current_;
+            self.current_ = nil;
+        }
+    }
+    
+    /* Returns a start time to pass to addTime, or nil if not profiling. */
+    start() {
+        return (self.current_) ? getTime(GetTimeTicks) : nil;
+    }
+    
+    /* Adds the time since startTime to the given phase. */
+    addTime(phase, startTime) {
+        if (startTime == nil || self.current_ == nil) {
+            return;
+        }
+        local ms = getTime(GetTimeTicks) - startTime;
+        local prev = self.current_.phaseMs[phase];
+        self.current_.phaseMs[phase] = (prev != nil) ? prev + ms : ms;
+    }
+    
+    /* As addTime('verify', ...), but also records the call itself. */
+    addVerify(verb, dobj, iobj, startTime) {
+        if (startTime == nil || self.current_ == nil) {
+            return;
+        }
+        local ms = getTime(GetTimeTicks) - startTime;
+        self.addTime('verify', startTime);
+        
+        local prof = self.current_;
+        local stats = prof.verbStats[verb];
+        prof.verbStats[verb] = (stats != nil) ? [stats[1] + 1, stats[2] + ms] : [1, ms];
+        
+        local slowest = prof.slowest;
+        if (slowest.length() < self.MAX_SLOWEST || ms > slowest[slowest.length()][1]) {
+            slowest = (slowest + [[ms, verb, dobj, iobj]]).sort(SortDesc, 
+                {a, b: a[1] - b[1]});
+            if (slowest.length() > self.MAX_SLOWEST) {
+                slowest = slowest.sublist(1, self.MAX_SLOWEST);
+            }
+            prof.slowest = slowest;
+        }
+    }
+    
+    /* Returns the name of the given verb, as per skald.verbNames. */
+    verbName(verb) {
+        local desc = skald.verbNames[verb];
+        return (desc) ? desc[2] : 'unknown';
+    }
+    
+    /* Returns the last reply's profile as a JSON object. */
+    getJson() {
+        local w = new SkaldJsonWriter();
+        local prof = self.last_;
+        w.beginObject();
+        w.key('enabled');
+        w.value(skald.PROFILE_AFFORDANCES);
+        if (prof) {
+            w.key('totalMs');
+            w.value(prof.totalMs);
+            w.lineSep();
+            w.key('phases');
+            w.beginObject();
+            prof.phaseMs.forEachAssoc(new function(phase, ms) {
+                w.key(phase);
+                w.value(ms);
+            });
+            w.endObject();
+            
+            w.lineSep();
+            w.key('verbs');
+            w.beginList();
+            prof.verbStats.forEachAssoc(new function(verb, stats) {
+                w.lineSep();
+                w.beginObject();
+                w.key('verb');
+                w.value(self.verbName(verb));
+                w.key('calls');
+                w.value(stats[1]);
+                w.key('ms');
+                w.value(stats[2]);
+                w.endObject();
+            });
+            w.endList();
+            
+            w.lineSep();
+            w.key('slowest');
+            w.beginList();
+            foreach (local call in prof.slowest) {
+                w.lineSep();
+                w.beginObject();
+                w.key('ms');
+                w.value(call[1]);
+                w.key('verb');
+                w.value(self.verbName(call[2]));
+                w.key('dobj');
+                w.value((call[3]) ? call[3].name : nil);
+                w.key('iobj');
+                w.value((call[4]) ? call[4].name : nil);
+                w.endObject();
+            }
+            w.endList();
+        }
+        w.endObject();
+        return w.getJson();
+    }
+    
+    /* Returns the last reply's profile formatted for the console. */
+    getReport() {
+        local prof = self.last_;
+        if (!prof) {
+            return 'No profile recorded yet.\n';
+        }
+        local report = 'Profile: ' + prof.totalMs + ' ms total\n';
+        prof.phaseMs.forEachAssoc({phase, ms: report += '* ' + phase + ': ' + ms + ' ms\n'});
+        report += 'Verify calls by verb:\n';
+        prof.verbStats.forEachAssoc(
+            {verb, stats: report += '* ' + self.verbName(verb) + ': ' + stats[1] + 
+                ' calls, ' + stats[2] + ' ms\n'});
+        report += 'Slowest verify calls:\n';
+        foreach (local call in prof.slowest) {
+            report += '* ' + call[1] + ' ms: ' + self.verbName(call[2]) + 
+                ((call[3]) ? ' ' + call[3].name : '') +
+                ((call[4]) ? ' / ' + call[4].name : '') + '\n';
+        }
+        return report;
     }
 ;
 
@@ -567,7 +1454,13 @@ DefineIAction(Affordances)
     execAction() {
         //XXX: Would be nice to have a console-formatted option, rather than
         // the noisy JSON.
-        "<<skald.getAffordances()>>";
+        skaldProfiler.beginReply();
+        local json = skald.getAffordances();
+        skaldProfiler.endReply();
+        "<<json>>";
+        if (skald.PROFILE_AFFORDANCES) {
+            "\b<<skaldProfiler.getReport()>>";
+        }
     }
 ;
 VerbRule(Affordances)
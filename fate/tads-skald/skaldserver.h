@@ -30,6 +30,9 @@
  * by modifying skaldServer.ROOT.)  
  * Then add this folder as a resource to your .t3m file:  
  *   -res tads-skald/htdocs
+ * (Running delivery/compress_htdocs.py before compiling adds precompressed 
+ * copies of the larger files, which the server will then send to browsers
+ * that accept them.)
  *
  * See skald.h for the configuration required and how to call 
  * skaldServer.start() to get the server going.
@@ -38,10 +41,13 @@
  *  Version: May 2013
  */
  
-/* Write to server buffer if server is running, else to normal tadsSay fn.*/
+/* 
+ * Write to server buffer if server is running (or benchmarking), else to 
+ * normal tadsSay fn.
+ */
 modify aioSay(txt) {
-    if (skaldServer.server && skaldServer.buffer) {
-        skaldServer.buffer.append(txt);
+    if ((skaldServer.server || skaldBench.active) && skaldServer.buffer) {
+        skaldServer.buffer.append(skaldOutputFilter.apply(txt));
     }else {
         replaced(txt);  //tadsSay in text mode, but something else for webui
     }
@@ -74,12 +80,18 @@ replace readMainCommand(which)
     }
     // execute any pre-command-prompt daemons 
     eventManager.executePrompt();  //as per original readMainCommand
+    skald.newTurn();  //the last turn is over, so its cached scope is stale
+    local cmd;
     if (skaldServer.server) {
-      return skaldServer.processRequests();  //waits until next cmd text recv'd
+      cmd = skaldServer.processRequests();  //waits until next cmd text recv'd
     }else {
+      skaldBench.endTurn();  //does nothing unless benchmarking
       //ORIGINAL rMC behavior
-      return inputManager.getInputLine(true, {: gLibMessages.mainCommandPrompt(which)});
+      cmd = inputManager.getInputLine(true, {: gLibMessages.mainCommandPrompt(which)});
+      skaldBench.beginTurn(cmd);
     }
+    skald.newTurn();  //and the cmd about to be run may change things again
+    return cmd;
 }
 
 /*
@@ -98,6 +110,10 @@ skaldServer : object
     server = nil    //should be activated by calling skaldServer.start()
     buffer = nil
     pendingRequest = nil  //a previous (cmd) request that we need to send output for
+    turnStart = nil       //when the pending request's turn started (ticks), for the log
+    requestQueue = nil    //init/cmd/batch requests received but not yet run,
+                          //oldest first (see queueRequest)
+    clientVersion = nil   //footer version the client says it has (see skald.DELTA_FOOTER)
     // XXX: getLaunchHostAddr() generally not useful.
     // Only seem to work when initialized here, not in start()
     // If server does not reply to CMDs, try setting skaldServer.hostname before you call
@@ -107,6 +123,31 @@ skaldServer : object
     quit = nil      //once true, the server will shutdown next chance it has
     connectionTimeout = nil  //if no UI requests received after this time in ms, 
                              //shuts down the server.  Set to nil to never timeout.
+    hibernateTimeout = nil   //if set, hibernate() after this many idle ms instead
+    hibernateFile = nil      //the saved game file hibernate() writes
+    hibernatedOutput = nil   //output still to be sent when the game hibernated
+    batchCmds = nil       //cmds from a batch request still to be run
+    batchOutput = nil     //the HTML output of each turn of the batch run so far
+    footerPending = nil   //the last reply's footer has yet to be fetched (SPLIT_REPLY)
+    readyFooter = nil     //that footer, once computed
+    eventsRequest = nil   //a held events request, answered once there is output
+    eventsExpire = nil    //time (in ticks) to answer eventsRequest regardless
+    asyncOutput = nil     //output from real-time events, for eventsRequest
+    
+    /* 
+     *   How long (in ms) an events request is held when there is nothing to
+     *   send.  Kept below the usual proxy timeouts.
+     */
+    EVENTS_TIMEOUT = 25000
+    
+    /*
+     *   If true, replies to cmd and init requests carry only the turn's output
+     *   and a footer of {"affordancesPending": true}.  The real footer is then
+     *   computed while the server is otherwise idle, and the client fetches it
+     *   from MODULE + 'affordances'.  This lets the player read the turn's 
+     *   output without waiting for the affordances to be computed.
+     */
+    SPLIT_REPLY = nil
     
     /*
      *   What level of detail to print to stdout.  The steps are cumulative 
@@ -115,6 +156,7 @@ skaldServer : object
      *   2 - Each CMD or INIT request.
      *   3 - Each server GET request.
      *   4 - Additional debug info
+     *   Lines are written in batches by skaldLog.
      */
     LOG_LEVEL = 3
     
@@ -140,37 +182,47 @@ skaldServer : object
             (IP: <<server.getIPAddress()>>)\n";
 
         buffer = new StringBuffer();
+        requestQueue = new Vector(8);
+        if (self.hibernatedOutput != nil) {
+            //resuming from hibernate(), so still owe the client this
+            buffer.append(self.hibernatedOutput);
+            self.hibernatedOutput = nil;
+        }
         quit = nil;
+        self.buildRoutes();
+        self.announceReady();
+    }
+    
+    /*
+     *   Prints a line like this to the console once the server is ready for
+     *   requests, for whatever started the game (see delivery/gamepool.py):
+     *   
+     *     SKALD-READY: {"mode": "skald", "host": "127.0.0.1", "port": 40001}
+     *
+     *   If the game is journaled, this also gives the journal's file as 
+     *   "journal", since it may not be the one asked for (see 
+     *   skaldJournal.start()).  This is printed regardless of LOG_LEVEL.
+     */
+    announceReady() {
+        local journal = (skaldJournal.filename != nil) ? 
+            ', "journal": "' + skaldJournal.filename + '"' : '';
+        tadsSay('SKALD-READY: {"mode": "skald", "host": "' + 
+                self.server.getAddress() + '", "port": ' + 
+                self.server.getPortNum() + journal + '}\n');
+        flushOutput();
     }
     
     /* 
      * Given a turn's HTML output, returns the contents that should be sent instead.
      * This can be used to handle a variety of different last minute tweaks, hacks,
-     * or work-arounds.
+     * or work-arounds.  (Tweaks that don't depend on the whole turn's output 
+     * belong in skaldOutputFilter instead, which is applied as text is printed.)
      */
     filterHtmlOutput(htmlStr) {
-      //replace all tags for debug viewing
-      //htmlStr = rexReplace(R'<langle>', htmlStr, '&lt;', ReplaceAll);
-      //htmlStr = rexReplace(R'<rangle>', htmlStr, '&gt;', ReplaceAll);
-      
       // remove initial <br> from responses
-      htmlStr = rexReplace(R'^<langle>br<rangle>', htmlStr, '', ReplaceOnce);
-      
-      // change Exit links to be object references 
-      // \v lowercases the next char
-      htmlStr = rexReplace([R'%<a +href="North"', R'%<a +href="South"',
-                            R'%<a +href="East"', R'%<a +href="West"',
-                            R'%<a +href="Up"', R'%<a +href="Down"',
-                            R'%<a +href="Northwest"', R'%<a +href="Southwest"',
-                            R'%<a +href="Northeast"', R'%<a +href="Southeast"'],
-                            htmlStr, 
-                            ['a href="?north"', 'a href="?south"',
-                            'a href="?east"', 'a href="?west"',
-                            'a href="?up"', 'a href="?down"',
-                            'a href="?northwest"', 'a href="?southwest"',
-                            'a href="?northeast"', 'a href="?southeast"'], 
-                            ReplaceAll);
-      
+      if (htmlStr.startsWith('<br>')) {
+          htmlStr = htmlStr.substr(5);
+      }
       return htmlStr;
     }
     
@@ -187,11 +239,74 @@ skaldServer : object
      *   Wraps the given str in the normal Skald header/footer and sends it as a
      *   a reply to the given evtRequest.
      */
-    sendReply(request, str) {
-        local contents = skald.getHeader();
-        contents += self.filterHtmlOutput(str.specialsToHtml());
-        contents += (self.quit) ? skald.getGameOverFooter() : skald.getFooter(); 
+    sendReply(request, str, isHtml?) {
+        local split = self.SPLIT_REPLY && !self.quit;
+        skaldProfiler.beginReply();
+        local contents = self.getReplyContents(str, split, isHtml);
         request.sendReply(contents);
+        skaldProfiler.endReply();
+        if (self.turnStart != nil) {
+            if (self.LOG_LEVEL >= 2) {
+                skaldLog.logTimed(2, 'REPLY: ' + contents.length() + ' chars', 
+                                  self.turnStart, true);
+            }
+            self.turnStart = nil;
+        }
+        if (split) {
+            self.footerPending = true;
+            self.readyFooter = nil;
+        }
+    }
+    
+    /*
+     *   Returns the given str wrapped in the normal Skald header/footer, as
+     *   sent by sendReply().  If split is true, uses a footer that only says
+     *   the affordances are pending (see SPLIT_REPLY).  If isHtml is true,
+     *   str has already been converted by toHtml().
+     */
+    getReplyContents(str, split?, isHtml?) {
+        local t = skaldProfiler.start();
+        local contents = skald.getHeader();
+        contents += (isHtml) ? str : self.toHtml(str);
+        skaldProfiler.addTime('output', t);
+        t = skaldProfiler.start();
+        if (self.quit) {
+            contents += skald.getGameOverFooter();
+        }else if (split) {
+            contents += skald.getPendingFooter();
+        }else {
+            contents += skald.getFooter(self.clientVersion); 
+        }
+        skaldProfiler.addTime('footer', t);
+        return contents;
+    }
+    
+    /*
+     *   Computes the footer for the last reply sent, ready to be fetched from
+     *   MODULE + 'affordances' (see SPLIT_REPLY).
+     */
+    prepareFooter() {
+        skaldProfiler.beginReply();
+        local t = skaldProfiler.start();
+        self.readyFooter = skald.getFooter(self.clientVersion);
+        skaldProfiler.addTime('footer', t);
+        skaldProfiler.endReply();
+    }
+    
+    /*
+     *   Forgets any footer still waiting to be fetched.  Called when a new
+     *   command will change the game state it describes.
+     */
+    dropPendingFooter() {
+        self.footerPending = nil;
+        self.readyFooter = nil;
+    }
+    
+    /*
+     *   Converts a turn's raw output to the HTML to send to the client.
+     */
+    toHtml(str) {
+        return self.filterHtmlOutput(str.specialsToHtml());
     }
     
     /* 
@@ -211,80 +326,461 @@ skaldServer : object
      * If there is currently no pending request, this call does nothing.
      */
     sendAnyPendingOutput() {     
-        if (self.pendingRequest) {
+        if (self.pendingRequest && self.batchOutput) {
+            self.saveBatchOutput();
+            self.sendReply(self.pendingRequest, self.batchOutput.join(''), true);
+            self.pendingRequest = nil;
+            self.batchOutput = nil;
+            self.batchCmds = nil;
+        }else if (self.pendingRequest) {
             self.sendOutputAsReply(self.pendingRequest);
             self.pendingRequest = nil;
         }
     }
     
+    /*
+     *   Moves the last batch turn's output from the buffer into batchOutput,
+     *   wrapped in a <div class="turn">.
+     */
+    saveBatchOutput() {
+        self.batchOutput.append('<div class="turn">' + 
+            self.toHtml(toString(self.buffer)) + '</div>\n');
+        self.buffer.deleteChars(1); //clear all
+    }
+    
+    /*
+     *   If a batch request is in progress and has cmds left to run (and the
+     *   game is not over), saves the last turn's output and returns the next
+     *   cmd.  Otherwise returns nil.
+     */
+    nextBatchCmd() {
+        if (self.batchCmds == nil || self.batchCmds.length() == 0 || self.quit) {
+            return nil;
+        }
+        self.saveBatchOutput();
+        local cmd = self.batchCmds[1];
+        self.batchCmds = self.batchCmds.sublist(2);
+        if (self.LOG_LEVEL >= 2) {
+            skaldLog.log(2, 'CMD: ' + cmd);
+        }
+        return cmd;
+    }
+    
     /*
      *   Processes web requests until a cmd is received.  Returns the contents
      *   as a string.
      */
     processRequests() {
+        //the last cmd's turn is over, so it is safe to journal now
+        skaldJournal.finishTurn();
+        
+        //when recovering, first rerun the journaled cmds since the snapshot
+        local replayCmd = skaldJournal.nextReplayCmd();
+        if (replayCmd != nil) {
+            self.buffer.deleteChars(1);  //only the last turn's output is still owed
+            return replayCmd;
+        }
+        
+        //keep running the cmds of a batch request, replying only after the last
+        local batchCmd = self.nextBatchCmd();
+        if (batchCmd != nil) {
+            return skaldJournal.record(batchCmd);
+        }
+        
         //handle any pending cmd request from last cycle
         sendAnyPendingOutput();
         
         if (self.quit) {
-            if (self.LOG_LEVEL >= 2) tadsSay('HTTP Server: Game over, so quitting...\n');
+            skaldLog.log(2, 'HTTP Server: Game over, so quitting...');
+            //still owe any queued requests a reply, which is now just game over
+            foreach (local entry in self.requestQueue) {
+                self.sendReply(entry[1], '');
+            }
+            skaldLog.flush();
+            skaldJournal.discard();  //ended, so nothing left to recover
             throw new QuittingException(); //shut it all down
         }
 
+        local lastRequest = getTime(GetTimeTicks);
         for (;;) {  //until we get a cmd
             
-            local evt = getNetEvent(self.connectionTimeout);  //timeout in ms
+            //run any real-time events due now, and note when the next is
+            local wake = self.runRealTimeEvents();
+            self.answerEvents();
+            if (self.eventsRequest != nil) {
+                wake = self.minTimeout(wake, 
+                    max(self.eventsExpire - getTime(GetTimeTicks), 0));
+            }
+            
+            local evt;
+            if (self.requestQueue.length() > 0) {
+                //take in any requests that have already arrived, then run
+                //the oldest queued one
+                evt = getNetEvent(0);
+                if (evt.evType == NetEvTimeout) {
+                    local cmd = self.nextQueuedCmd();
+                    if (cmd != nil) {
+                        return skaldJournal.record(cmd);
+                    }
+                    continue;
+                }
+            }else if (self.footerPending && self.readyFooter == nil) {
+                // compute the split-off footer if no request is waiting
+                evt = getNetEvent(0);
+                if (evt.evType == NetEvTimeout) {
+                    self.prepareFooter();
+                    continue;
+                }
+            }else {
+                local idle = (self.hibernateTimeout != nil) ? 
+                    self.hibernateTimeout : self.connectionTimeout;
+                if (idle != nil) {
+                    idle = max(idle - (getTime(GetTimeTicks) - lastRequest), 0);
+                }
+                local wait = self.minTimeout(idle, wake);
+                skaldLog.flush();  //nothing else to do while we wait
+                skaldJournal.snapshotIfDue();  //after flushing, so no log lines are saved
+                evt = getNetEvent(wait);  //timeout in ms
+                if (evt.evType == NetEvTimeout && (idle == nil || wait < idle)) {
+                    continue;  //woken for an event, so not idle yet
+                }
+                if (evt.evType == NetEvTimeout && self.hibernateTimeout != nil) {
+                    self.hibernate();
+                }
+            }
             if (evt.evType == NetEvTimeout) {
                 if (self.LOG_LEVEL >= 1) {
-                    tadsSay('HTTP Server connection timed out (' + self.connectionTimeout + 
-                            'ms without a UI request)\n');
+                    skaldLog.log(1, 'HTTP Server connection timed out (' + 
+                                 self.connectionTimeout + 'ms without a UI request)');
+                    skaldLog.flush();
+                    skaldJournal.discard();
                     throw new QuittingException(); //shut it all down
                 }
             } else if (evt.evType == NetEvRequest && evt.evRequest.ofKind(HTTPRequest)) {
                 local req = evt.evRequest;
                 local query = req.parseQuery();
-                //init
-                if (req.getQuery() == self.MODULE + 'init') {
-                    if (self.buffer.length() == 0) {
-                        //probably due to a browser refresh.  Should send something...
-                        if (self.LOG_LEVEL >= 2) tadsSay('INIT: No contents to send, so Looking.\n');
-                        self.pendingRequest = req;
-                        return 'Look';
-                    }else {
-                        if (self.LOG_LEVEL >= 2) tadsSay('INIT\n');
+                local route = self.routes[query[1]];
+                local received = getTime(GetTimeTicks);
+                if (route != &handleEvents) {
+                    //(a held events request is no sign the player is still there)
+                    lastRequest = received;
+                }
+                if (dataType(route) == TypeProp) {
+                    //an endpoint; some of these start a turn
+                    local cmd = self.(route)(req, query);
+                    if (cmd != nil) {
+                        return skaldJournal.record(cmd);
                     }
-                    self.sendOutputAsReply(req);
-
-                //cmd (by POST)
-                }else if (req.getQuery() == self.MODULE + 'cmd') {
-                    local f = req.getBody();
-                    if (f != nil) {
-                        local contents = '';
-                        local line = f.readFile();
-                        while (line != nil) {
-                            contents += line;
-                            line = f.readFile();
-                        }
-                        if (self.LOG_LEVEL >= 2) tadsSay('CMD: ' + contents + '\n');
-                        self.pendingRequest = req;
-                        return contents;
-                    }else {
-                        if (self.LOG_LEVEL >= 2) tadsSay('CMD: [empty body]\n');
+                }else if (route != nil) {
+                    //a known static resource
+                    skaldWebResources.sendResource(req, route);
+                    if (self.LOG_LEVEL >= 3) {
+                        skaldLog.logTimed(3, 'GET: ' + query[1], received);
                     }
                     
-                //a request for web file or other resource
+                //a request for some other web file or resource
                 }else {
-                    if (self.LOG_LEVEL >= 3) tadsSay('GET: <<query[1]>>\n');
+                    local path = query[1];
                     if (query[1] == '/') {
                         query[1] = '/index.html';
-                        if (self.LOG_LEVEL >= 4) tadsSay('GET converted: / -> /index.html\n');
+                        skaldLog.log(4, 'GET converted: / -> /index.html');
                     }
                     query[1] = self.ROOT + query[1];
                     skaldWebResources.processRequest(req, query);
+                    if (self.LOG_LEVEL >= 3) {
+                        skaldLog.logTimed(3, 'GET: ' + path, received);
+                    }
                 }
             }//end HTTP request
         }//end for
     }//end processRequests
     
+    /*
+     *   Routes: request path -> either the property of the skaldServer method
+     *   that handles it, or the name of the static resource to send.  Each
+     *   handler takes (req, query) and returns the cmd to run next, if any.
+     *   Built by buildRoutes().  Paths not found here are looked up as
+     *   resources under ROOT instead.
+     */
+    routes = nil
+    
+    /*
+     *   Builds the routes table: one entry for each endpoint, plus one for
+     *   each web file listed in the htdocs manifest (see compress_htdocs.py),
+     *   if there is one.  Modify this (or call addRoute after start()) to
+     *   add further endpoints.
+     */
+    buildRoutes() {
+        self.routes = new LookupTable(32, 64);
+        self.addRoute(self.MODULE + 'init', &handleInit);
+        self.addRoute(self.MODULE + 'cmd', &handleCmd);
+        self.addRoute(self.MODULE + 'batch', &handleBatch);
+        self.addRoute(self.MODULE + 'affordances', &handleAffordances);
+        self.addRoute(self.MODULE + 'profile', &handleProfile);
+        self.addRoute(self.MODULE + 'events', &handleEvents);
+        
+        local dir = skaldWebResources.processName(self.ROOT) + '/';
+        foreach (local path in skaldWebResources.readManifest(dir)) {
+            self.addRoute('/' + path, dir + path);
+        }
+        if (self.routes['/index.html'] != nil) {
+            self.addRoute('/', self.routes['/index.html']);
+        }
+    }
+    
+    /* 
+     *   Sends requests for the given path to the given handler method (a
+     *   property pointer) or static resource (a resource name).
+     */
+    addRoute(path, handler) {
+        self.routes[path] = handler;
+    }
+    
+    /* init: resends the last turn's output (once any queued cmds are done) */
+    handleInit(req, query) {
+        if (self.requestQueue.length() == 0 && self.buffer.length() > 0) {
+            skaldLog.log(2, 'INIT');
+            self.clientVersion = nil;  //always a full resync
+            self.sendOutputAsReply(req);
+        }else {
+            self.queueRequest(req, nil, nil, nil);
+        }
+        return nil;
+    }
+    
+    /* cmd (by POST) */
+    handleCmd(req, query) {
+        local f = req.getBody();
+        if (f != nil) {
+            local contents = '';
+            local line = f.readFile();
+            while (line != nil) {
+                contents += line;
+                line = f.readFile();
+            }
+            self.queueRequest(req, [contents], nil, self.getVersion(query));
+        }else {
+            skaldLog.log(2, 'CMD: [empty body]');
+        }
+        return nil;
+    }
+    
+    /* several cmds (by POST, one per line), run as consecutive turns */
+    handleBatch(req, query) {
+        local cmds = self.readBatchCmds(req);
+        if (self.LOG_LEVEL >= 2) {
+            skaldLog.log(2, 'BATCH: ' + cmds.length() + ' cmds');
+        }
+        if (cmds.length() == 0 && self.requestQueue.length() == 0) {
+            //nothing to run, but still owed a reply
+            self.clientVersion = self.getVersion(query);
+            self.pendingRequest = req;
+            self.dropPendingFooter();
+            self.batchOutput = new Vector(1);
+            self.sendAnyPendingOutput();
+        }else {
+            self.queueRequest(req, cmds, true, self.getVersion(query));
+        }
+        return nil;
+    }
+    
+    /* returns the footer version the client gave in query, if any */
+    getVersion(query) {
+        return (query['v'] != nil) ? toInteger(query['v']) : nil;
+    }
+    
+    /*
+     *   Queues a request to be run in turn, after any received before it.
+     *   cmds is the list of cmds to run for it (nil for an init), batch is
+     *   true for a batch request, and version is its footer version.  Each
+     *   gets its own reply, in order, so clients may send cmds without 
+     *   waiting for the replies to earlier ones.
+     */
+    queueRequest(req, cmds, batch, version) {
+        self.requestQueue.append([req, cmds, batch, version]);
+    }
+    
+    /*
+     *   Removes queued requests, oldest first, until one has a cmd to run.
+     *   Makes that the pendingRequest and returns its (first) cmd.  Returns
+     *   nil if the queue runs out first.
+     */
+    nextQueuedCmd() {
+        while (self.requestQueue.length() > 0) {
+            local entry = self.requestQueue[1];
+            self.requestQueue.removeElementAt(1);
+            local req = entry[1];
+            local cmds = entry[2];
+            
+            if (cmds == nil) {
+                //init
+                self.clientVersion = nil;  //always a full resync
+                if (self.buffer.length() > 0) {
+                    skaldLog.log(2, 'INIT');
+                    self.turnStart = getTime(GetTimeTicks);
+                    self.sendOutputAsReply(req);
+                    continue;
+                }
+                //probably due to a browser refresh.  Should send something...
+                skaldLog.log(2, 'INIT: No contents to send, so Looking.');
+                cmds = ['Look'];
+            }else {
+                self.clientVersion = entry[4];
+            }
+            self.pendingRequest = req;
+            self.dropPendingFooter();
+            if (entry[3]) {
+                //batch
+                self.batchOutput = new Vector(cmds.length() + 1);
+                if (cmds.length() == 0) {
+                    self.sendAnyPendingOutput();  //nothing to run
+                    continue;
+                }
+                self.batchCmds = cmds.sublist(2);
+                if (self.buffer.length() > 0) {
+                    //still owed output from before (such as the intro) goes
+                    //first, outside the turns
+                    self.batchOutput.append(self.toHtml(toString(self.buffer)));
+                    self.buffer.deleteChars(1);
+                }
+            }
+            if (self.LOG_LEVEL >= 2) {
+                skaldLog.log(2, 'CMD: ' + cmds[1]);
+            }
+            self.turnStart = getTime(GetTimeTicks);
+            return cmds[1];
+        }
+        return nil;
+    }
+    
+    /* the footer split off from the last reply (see SPLIT_REPLY) */
+    handleAffordances(req, query) {
+        skaldLog.log(2, 'AFFORDANCES');
+        if (self.readyFooter == nil) {
+            self.prepareFooter();  //not ready yet, so do it now
+        }
+        req.sendReply(self.readyFooter, 'text/html', 200);
+        self.dropPendingFooter();
+        return nil;
+    }
+    
+    /* profile of the last reply (see skald.PROFILE_AFFORDANCES) */
+    handleProfile(req, query) {
+        skaldLog.log(2, 'PROFILE');
+        req.sendReply(skaldProfiler.getJson(), 'application/json', 200);
+        return nil;
+    }
+    
+    /* 
+     *   events (long-poll): held until some real-time event prints something,
+     *   which is then sent with the normal header but no footer, since no 
+     *   command has run (see answerEvents).  Sent empty (with a 204) if 
+     *   nothing is printed within EVENTS_TIMEOUT ms.
+     */
+    handleEvents(req, query) {
+        skaldLog.log(3, 'EVENTS');
+        if (self.eventsRequest != nil) {
+            self.eventsRequest.sendReply('', 'text/html', 204);  //superseded
+        }
+        if (self.asyncOutput == nil) {
+            self.asyncOutput = new StringBuffer();
+        }
+        self.eventsRequest = req;
+        self.eventsExpire = getTime(GetTimeTicks) + self.EVENTS_TIMEOUT;
+        self.answerEvents();
+        return nil;
+    }
+    
+    /*
+     *   Answers the held events request, if there is one and there is output
+     *   for it or it has been held long enough.
+     */
+    answerEvents() {
+        if (self.eventsRequest == nil) {
+            return;
+        }
+        if (self.asyncOutput.length() > 0) {
+            //not sendReply(), which would start a new footer version
+            self.eventsRequest.sendReply(
+                skald.getHeader() + self.toHtml(toString(self.asyncOutput)),
+                'text/html', 200);
+            self.asyncOutput.deleteChars(1);
+        }else if (getTime(GetTimeTicks) >= self.eventsExpire) {
+            self.eventsRequest.sendReply('', 'text/html', 204);
+        }else {
+            return;
+        }
+        self.eventsRequest = nil;
+    }
+    
+    /*
+     *   Runs any RealTimeEvents (such as RealTimeDaemons) that are due, as the
+     *   normal input loop would.  If a client has used the events endpoint, 
+     *   what they print is set aside for it; otherwise it is simply sent with
+     *   the next reply.  Returns the ms until the next event, or nil if none.
+     */
+    runRealTimeEvents() {
+        local start = self.buffer.length();
+        local next = realTimeManager.runEvents();
+        skald.newTurn();  //an event may have changed what is in scope
+        if (self.buffer.length() > start) {
+            self.readyFooter = nil;  //so recompute any footer still pending
+        }
+        if (self.asyncOutput != nil && self.buffer.length() > start) {
+            self.asyncOutput.append(self.buffer.substr(start + 1));
+            self.buffer.deleteChars(start + 1);
+        }
+        return (next == nil) ? nil : max(next - getTime(GetTimeTicks), 0);
+    }
+    
+    /* returns the shorter of two getNetEvent() timeouts, where nil = never */
+    minTimeout(a, b) {
+        return (a == nil) ? b : ((b == nil) ? a : min(a, b));
+    }
+    
+    /*
+     *   Returns the non-blank lines of the given request's body as a list of
+     *   cmd strings.
+     */
+    readBatchCmds(req) {
+        local cmds = [];
+        local f = req.getBody();
+        if (f != nil) {
+            local line = f.readFile();
+            while (line != nil) {
+                line = line.findReplace(['\n', '\u000D'], ['', '']);
+                if (line.length() > 0) {
+                    cmds += line;
+                }
+                line = f.readFile();
+            }
+        }
+        return cmds;
+    }
+    
+    /*
+     *   Saves the game (along with any output not yet fetched by the client)
+     *   to hibernateFile and quits, freeing the interpreter while the player
+     *   is idle.  Prints a line like this to the console first:
+     *
+     *     SKALD-HIBERNATED: {"file": "40001-fate-skald.t3.t3v"}
+     *
+     *   Whatever started the game can later restart it from that file (see
+     *   startup.h's -restore), and the player can carry on.
+     */
+    hibernate() {
+        skaldLog.log(1, 'Idle, so hibernating to ' + self.hibernateFile);
+        self.hibernatedOutput = toString(self.buffer);
+        self.pendingRequest = nil;
+        self.dropPendingFooter();
+        self.shutdown();  //no server in the saved state
+        saveGame(self.hibernateFile);
+        skaldLog.flush();
+        tadsSay('SKALD-HIBERNATED: {"file": "' + self.hibernateFile + '"}\n');
+        flushOutput();
+        throw new QuittingException();
+    }
+    
     /*
      *   Kill the server.  This will direct all future output to console again.
      *   If server is not active, can be safely called with no effect.
@@ -293,12 +789,406 @@ skaldServer : object
         if (self.server) {
             self.server.shutdown();
             self.server = nil;
+            skaldLog.flush();
             if (self.LOG_LEVEL >= 1) "HTTP Server shutdown.\n";
         }
     }
 ;
    
   
+/*
+ *   The server's log.  Lines are filtered by skaldServer.LOG_LEVEL as they
+ *   are logged (by the caller too, where the line must be built first, so
+ *   that a dropped line costs nothing), then held in a fixed-size buffer and written out together
+ *   when the server next goes idle (or the buffer fills), so that serving a
+ *   request never waits on a write.
+ *
+ *   By default, lines are printed to the console, and so also appear in 
+ *   the game's transcript log (where delivery/log2cmds.py finds the CMD 
+ *   lines).  If FILENAME is set, they are appended to that file instead,
+ *   which is moved aside to FILENAME.1 (and so on, up to KEEP_FILES) once 
+ *   it grows past ROTATE_BYTES.
+ */
+skaldLog: object
+    
+    FILENAME = nil             //nil = console
+    ROTATE_BYTES = 1024 * 1024 //about; checked after each write
+    KEEP_FILES = 3             //rotated files kept, besides FILENAME itself
+    CAPACITY = 128             //lines held before writing regardless
+    
+    lines_ = nil   //Vector of CAPACITY lines; only the first count_ are used
+    count_ = 0
+    fileBytes_ = nil  //size of FILENAME, once known
+    
+    /* Logs the given line, if its level is being logged. */
+    log(level, line) {
+        if (level > skaldServer.LOG_LEVEL) {
+            return;
+        }
+        if (self.lines_ == nil) {
+            self.lines_ = new Vector(self.CAPACITY, self.CAPACITY);
+        }else if (self.count_ == self.CAPACITY) {
+            self.flush();
+        }
+        self.count_++;
+        self.lines_[self.count_] = line;
+    }
+    
+    /* 
+     *   As log, but adds how long it has been since start (in ticks), like:
+     *   GET: /skald/skald.css (2ms)
+     *
+     *   If stamped, also adds when (in seconds since 1970), like:
+     *   REPLY: 5120 chars (38ms) at 1792281600
+     */
+    logTimed(level, line, start, stamped?) {
+        if (level <= skaldServer.LOG_LEVEL) {
+            line += ' (' + (getTime(GetTimeTicks) - start) + 'ms)';
+            if (stamped) {
+                line += ' at ' + getTime(GetTimeDateAndTime)[9];
+            }
+            self.log(level, line);
+        }
+    }
+    
+    /* Writes out any lines logged since the last flush. */
+    flush() {
+        if (self.count_ == 0) {
+            return;
+        }
+        local out = new StringBuffer(self.count_ * 48);
+        for (local i = 1; i <= self.count_; i++) {
+            out.append(self.lines_[i]);
+            out.append('\n');
+            self.lines_[i] = nil;
+        }
+        self.count_ = 0;
+        
+        if (self.FILENAME == nil) {
+            tadsSay(toString(out));
+            return;
+        }
+        local f = File.openTextFile(self.FILENAME, FileAccessReadWriteKeep);
+        f.setPosEnd();
+        f.writeFile(toString(out));
+        self.fileBytes_ = f.getPos();
+        f.closeFile();
+        if (self.fileBytes_ > self.ROTATE_BYTES) {
+            self.rotate();
+        }
+    }
+    
+    /* 
+     *   Moves FILENAME to FILENAME.1, FILENAME.1 to FILENAME.2, and so on,
+     *   dropping the oldest.  (TADS has no rename, so each is copied.)
+     */
+    rotate() {
+        local oldest = self.FILENAME + '.' + self.KEEP_FILES;
+        if (self.exists(oldest)) {
+            File.deleteFile(oldest);
+        }
+        for (local i = self.KEEP_FILES - 1; i >= 0; i--) {
+            local from = (i == 0) ? self.FILENAME : self.FILENAME + '.' + i;
+            if (self.exists(from)) {
+                self.copyFile(from, self.FILENAME + '.' + (i + 1));
+                File.deleteFile(from);
+            }
+        }
+        self.fileBytes_ = 0;
+    }
+    
+    exists(filename) {
+        return File.getFileType(filename) != nil;
+    }
+    
+    copyFile(from, to) {
+        local src = File.openRawFile(from, FileAccessRead);
+        local dest = File.openRawFile(to, FileAccessWrite);
+        local bytes = new ByteArray(src.getFileSize());
+        src.readBytes(bytes);
+        dest.writeBytes(bytes);
+        src.closeFile();
+        dest.closeFile();
+    }
+;
+
+/*
+ *   A journal of every cmd run by the server, one per line, along with a
+ *   saved game (snapshot) of the whole game state every SNAPSHOT_EVERY 
+ *   cmds.  Each cmd is only journaled once its turn is over, so a cmd that
+ *   crashed the game is not run again when recovering it.  The journal 
+ *   looks like:
+ *
+ *     1 x me
+ *     2 north
+ *     ...
+ *     SNAPSHOT 25 9c2e5a1f03b7d846-fate-skald.t3.journal.1.t3v
+ *     26 get coin
+ *
+ *   If the game crashes, it can be recovered from its journal (see 
+ *   startup.h's -recover): the last snapshot is restored and only the cmds
+ *   after it are run again.  (As when replaying a .cmds file, the game must
+ *   run the same way given the same cmds.)
+ *
+ *   Snapshots alternate between two files, so there is always a complete
+ *   one to go back to.  They are only taken while the server is idle.  
+ *   Both are named after the journal, which is named by session (see 
+ *   startup.sessionName()) so that a later game on the same port can't 
+ *   overwrite them.  The journal and its snapshots are deleted once the
+ *   game ends without crashing.
+ */
+skaldJournal: object
+    
+    SNAPSHOT_EVERY = 25  //cmds
+    
+    filename = nil      //the journal; nil = no journal
+    turn = 0            //number of cmds journaled (and so run)
+    runningCmd = nil    //cmd whose turn is running, to journal once it's over
+    snapshotTurn = 0    //turn of the last snapshot
+    snapshots = 0       //number of snapshots taken
+    replayCmds = nil    //cmds still to be rerun by recover()
+    
+    /* 
+     *   Starts a new (empty) journal in the given file or, if that is 
+     *   already some other session's journal, in filename.2 (or .3...).
+     *   Whatever started the game learns which from its ready line (see
+     *   skaldServer.announceReady()).
+     */
+    start(filename) {
+        local name = filename;
+        for (local i = 2; File.getFileType(name) != nil; i++) {
+            name = filename + '.' + i;
+        }
+        self.filename = name;
+        File.openTextFile(name, FileAccessWrite).closeFile();
+    }
+    
+    /* 
+     *   Notes the given cmd, which is about to be run, to be journaled by 
+     *   finishTurn().  Returns cmd. 
+     */
+    record(cmd) {
+        if (self.filename != nil) {
+            self.runningCmd = cmd;
+        }
+        return cmd;
+    }
+    
+    /* Journals the cmd given to record(), now that its turn is over. */
+    finishTurn() {
+        if (self.runningCmd != nil) {
+            self.turn++;
+            self.append(toString(self.turn) + ' ' + 
+                        self.runningCmd.findReplace('\n', ' ') + '\n');
+            self.runningCmd = nil;
+        }
+    }
+    
+    /* Deletes the journal and its snapshots, and journals no more. */
+    discard() {
+        if (self.filename == nil) {
+            return;
+        }
+        foreach (local file in [self.filename, self.filename + '.1.t3v', 
+                                self.filename + '.2.t3v']) {
+            if (File.getFileType(file) != nil) {
+                File.deleteFile(file);
+            }
+        }
+        self.filename = nil;
+    }
+    
+    /*
+     *   Takes a snapshot if SNAPSHOT_EVERY cmds have been run since the last.
+     *   Call only between requests, since network objects are not saved.
+     */
+    snapshotIfDue() {
+        if (self.filename == nil || self.turn - self.snapshotTurn < self.SNAPSHOT_EVERY) {
+            return;
+        }
+        local file = self.filename + '.' + (self.snapshots % 2 + 1) + '.t3v';
+        self.snapshotTurn = self.turn;
+        self.snapshots++;
+        
+        //leave out what can't be restored (as hibernate() does)
+        local server = skaldServer.server;
+        local events = skaldServer.eventsRequest;
+        skaldServer.server = nil;
+        skaldServer.eventsRequest = nil;
+        try {
+            saveGame(file);
+        }
+        finally {
+            skaldServer.server = server;
+            skaldServer.eventsRequest = events;
+        }
+        self.append('SNAPSHOT ' + self.turn + ' ' + file + '\n');
+    }
+    
+    /* 
+     *   Returns the file of the last snapshot recorded in the given journal,
+     *   or nil if there is none.
+     */
+    lastSnapshot(filename) {
+        local snapshot = nil;
+        self.forEachLine(filename, new function(line) {
+            if (line.startsWith('SNAPSHOT ')) {
+                snapshot = line.substr(line.find(' ', 10) + 1);
+            }
+        });
+        return snapshot;
+    }
+    
+    /*
+     *   Carries on the given journal, first rerunning (through 
+     *   processRequests) each cmd in it after the current turn: that is, 
+     *   after the snapshot the game was restored from, if any.
+     */
+    recover(filename) {
+        self.filename = filename;
+        local cmds = new Vector(64);
+        self.forEachLine(filename, new function(line) {
+            local sp = line.find(' ');
+            if (sp != nil && !line.startsWith('SNAPSHOT ') && 
+                toInteger(line.substr(1, sp - 1)) > self.turn) {
+                cmds.append(line.substr(sp + 1));
+            }
+        });
+        self.replayCmds = cmds.toList();
+    }
+    
+    /* Returns the next cmd to rerun when recovering, or nil if none. */
+    nextReplayCmd() {
+        if (self.replayCmds == nil || self.replayCmds.length() == 0) {
+            self.replayCmds = nil;
+            return nil;
+        }
+        local cmd = self.replayCmds[1];
+        self.replayCmds = self.replayCmds.sublist(2);
+        self.turn++;  //already journaled
+        return cmd;
+    }
+    
+    append(str) {
+        local f = File.openTextFile(self.filename, FileAccessReadWriteKeep);
+        f.setPosEnd();
+        f.writeFile(str);
+        f.closeFile();
+    }
+    
+    /* Calls func on each line of the given file, if it exists. */
+    forEachLine(filename, func) {
+        local f;
+        try {
+            f = File.openTextFile(filename, FileAccessRead);
+        }
+        catch (FileException e) {
+            return;
+        }
+        for (local line = f.readFile(); line != nil; line = f.readFile()) {
+            func(rexReplace('[\r\n]+$', line, '', ReplaceOnce));
+        }
+        f.closeFile();
+    }
+;
+
+   
+/*
+ *   Benchmark mode, used by delivery/bench.py to replay transcripts without
+ *   a browser.  The game runs on the console as usual (reading commands
+ *   from a -i command file), but each turn's output is captured and run
+ *   through the same reply-building code as a /skald/cmd request.  After
+ *   each turn, a line like this is appended to FILENAME:
+ *
+ *     {"turn": 3, "cmd": "get coin", "cmdMs": 2, "replyMs": 40, 
+ *      "bytes": 5120, "phases": {...}, "footer": "..."}
+ *
+ *   cmdMs is the time to execute the command (and any daemons), replyMs is
+ *   the time to build the reply, and phases are the skaldProfiler phases
+ *   for that reply ("footer" being the whole getFooter() call).  "footer" is
+ *   the footer itself, so output can be compared between builds.  Turn 0 is
+ *   the game's introduction.
+ *
+ *   Started by startup.start() when the game is run with a -bench argument.
+ */
+skaldBench: object
+    
+    /* File the turn results are written to, in the current directory. */
+    FILENAME = 'skald-bench.jsonl'
+    
+    active = nil
+    turn = 0
+    cmd_ = nil
+    cmdStart_ = nil
+    
+    /* Starts benchmarking.  Does not start the server. */
+    start() {
+        self.active = true;
+        skald.PROFILE_AFFORDANCES = true;
+        skald.buildFilterSet();
+        skaldServer.buffer = new StringBuffer();
+        File.openTextFile(self.FILENAME, FileAccessWrite).closeFile();  //truncate
+    }
+    
+    /* Notes the start of executing the given command. */
+    beginTurn(cmd) {
+        if (!self.active) {
+            return;
+        }
+        skaldServer.buffer.deleteChars(1);  //drop the prompt and input echo
+        self.cmd_ = cmd;
+        self.cmdStart_ = getTime(GetTimeTicks);
+    }
+    
+    /* 
+     *   Ends the current turn: builds its reply and writes the turn's
+     *   benchmark line.
+     */
+    endTurn() {
+        if (!self.active) {
+            return;
+        }
+        local cmdMs = (self.cmdStart_) ? getTime(GetTimeTicks) - self.cmdStart_ : 0;
+        skaldProfiler.beginReply();
+        local start = getTime(GetTimeTicks);
+        local contents = skaldServer.getReplyContents(toString(skaldServer.buffer));
+        local replyMs = getTime(GetTimeTicks) - start;
+        skaldProfiler.endReply();
+        skaldServer.buffer.deleteChars(1);
+        
+        local footer = contents.substr(contents.find('<script class="footer">'));
+        local w = new SkaldJsonWriter();
+        w.beginObject();
+        w.key('turn');
+        w.value(self.turn);
+        w.key('cmd');
+        w.value(self.cmd_);
+        w.key('cmdMs');
+        w.value(cmdMs);
+        w.key('replyMs');
+        w.value(replyMs);
+        w.key('bytes');
+        w.value(contents.length());
+        w.key('phases');
+        w.beginObject();
+        skaldProfiler.last_.phaseMs.forEachAssoc(new function(phase, ms) {
+            w.key(phase);
+            w.value(ms);
+        });
+        w.endObject();
+        w.key('footer');
+        w.value(footer.findReplace('\n', ''));
+        w.endObject();
+        w.write('\n');
+        
+        local f = File.openTextFile(self.FILENAME, FileAccessReadWriteKeep);
+        f.setPosEnd();
+        f.writeFile(w.getJson());
+        f.closeFile();
+        self.turn++;
+    }
+;
+
 /* ------------------------------------------------------------------------ */
 //FROM TADS's webui.t:
 // Skald prepended to avoid conflict with existing WebUI library if both compiled in
@@ -504,48 +1394,163 @@ class SkaldWebResourceResFile: SkaldWebResource
         return inherited(query, req) && resExists(processName(query[1]));
     }
 
-    /* process the request: send the resource file's contents */
+    /*
+     *   Process the request: send the resource file's contents.  Each file
+     *   is read only once; after that it is served from resCache.
+     */
     processRequest(req, query)
     {
         /* get the local resource name */ 
         // after prepending folder location of all server files
-        local name = processName(query[1]);
+        sendResource(req, processName(query[1]));
+    }
 
+    /*
+     *   Send the given resource (by resource name) as the reply to req, or
+     *   a 404 if there is no such resource.
+     */
+    sendResource(req, name)
+    {
+        local res = getCachedResource(name);
+        if (res == nil)
+        {
+            /* send a 404 error */
+            req.sendReply(404);
+            return;
+        }
+        res.sendTo(req);
+    }
+
+    /* loaded resources, as resource name -> SkaldCachedResource */
+    resCache = nil
+
+    /*
+     *   Returns the SkaldCachedResource for the given resource name,
+     *   loading it first if this is the first request for it.  Returns nil
+     *   if there is no such resource.
+     */
+    getCachedResource(name)
+    {
+        if (resCache == nil)
+            resCache = new LookupTable();
+        local res = resCache[name];
+        if (res == nil)
+        {
+            res = loadResource(name);
+            if (res != nil)
+                resCache[name] = res;
+        }
+        return res;
+    }
+
+    /*
+     *   Reads the whole of the given resource file into a new
+     *   SkaldCachedResource.  Returns nil if it can't be opened.
+     */
+    loadResource(name)
+    {
         /* get the filename suffix (extension) */
         local ext = nil;
         if (rexSearch('%.([^.]+)$', name) != nil)
             ext = rexGroup(1)[3];
 
+        local contents;
         local fp = nil;
         try
         {
-            /* open the file in the appropriate mode */
+            /* read the file in the appropriate mode */
             if (isTextFile(name))
+            {
                 fp = File.openTextResource(name);
+                local buf = new StringBuffer(fp.getFileSize());
+                for (local line = fp.readFile() ; line != nil ;
+                     line = fp.readFile())
+                    buf.append(line);
+                contents = toString(buf);
+            }
             else
-                fp = File.openRawResource(name);            
+            {
+                contents = loadRawResource(name);
+                if (contents == nil)
+                    return nil;
+            }
         }
         catch (FileException exc)
         {
-            /* send a 404 error */
-            req.sendReply(404);
-            return;
+            return nil;
+        }
+        finally
+        {
+            if (fp != nil)
+                fp.closeFile();
         }
 
         /*
-         *   If the file suffix implies a particular mime type, set it.
+         *   If the file suffix implies a particular mime type, use it.
          *   There are some media types that are significant to browsers,
          *   but which the HTTPRequest object can't infer based on the
          *   contents, so as a fallback infer the media type from the
          *   filename suffix if possible.
          */
-        local mimeType = browserExtToMime[ext];
+        local res = new SkaldCachedResource(contents, browserExtToMime[ext],
+                                            isImmutable(name));
+
+        /*
+         *   Add any precompressed variants (see compress_htdocs.py).  These
+         *   are only sent with a known MIME type, since HTTPRequest can't
+         *   infer one from compressed contents.
+         */
+        if (res.mimeType != nil)
+        {
+            foreach (local enc in encodings)
+            {
+                if (resExists(name + enc[2]))
+                {
+                    local bytes = loadRawResource(name + enc[2]);
+                    if (bytes != nil)
+                        res.addVariant(enc[1], bytes);
+                }
+            }
+        }
+        return res;
+    }
 
-        /* send the file's contents */
-        req.sendReply(fp, mimeType);
+    /*
+     *   Content-Encodings we may have precompressed variants for, in order of
+     *   preference, as [encoding, resource name suffix].
+     */
+    encodings = [['br', '.br'], ['gzip', '.gz']]
 
-        /* done with the file */
-        fp.closeFile();
+    /* returns the given resource as a ByteArray, or nil if it can't be read */
+    loadRawResource(name)
+    {
+        local fp = nil;
+        try
+        {
+            fp = File.openRawResource(name);
+            local bytes = new ByteArray(fp.getFileSize());
+            fp.readBytes(bytes);
+            return bytes;
+        }
+        catch (FileException exc)
+        {
+            return nil;
+        }
+        finally
+        {
+            if (fp != nil)
+                fp.closeFile();
+        }
+    }
+
+    /*
+     *   Determine if the given file's name is specific to its contents, and
+     *   so can be cached by the browser forever.  GWT names such files
+     *   <hash>.cache.<ext>.
+     */
+    isImmutable(fname)
+    {
+        return rexMatch('.*%.cache%.[^./]+$', fname) != nil;
     }
 
     /* extension to MIME type map for important browser file types */
@@ -598,6 +1603,159 @@ class SkaldWebResourceResFile: SkaldWebResource
 
 // END: from webui.t
 
+/*
+ *   Rewrites output as it is appended to skaldServer.buffer (see aioSay), 
+ *   replacing each occurrence of a rule's text with its replacement.  The
+ *   rules are compiled into a single pattern, so each piece of output is 
+ *   scanned just once however many rules there are.
+ *
+ *   Rules only match text printed in one piece, such as a whole tag returned
+ *   by aHref().  Add rules with addRule() (say, from a PreinitObject).
+ */
+skaldOutputFilter: object
+    rules_ = nil       //rule text -> replacement
+    firstChars_ = nil  //the distinct first characters of the rules' text
+    pattern_ = nil     //all rules' text as one RexPattern; nil until compiled
+    
+    /* Adds a rule replacing the literal text from with to. */
+    addRule(from, to) {
+        if (self.rules_ == nil) {
+            self.rules_ = new LookupTable();
+            self.firstChars_ = [];
+        }
+        self.rules_[from] = to;
+        self.firstChars_ = self.firstChars_.appendUnique([from.substr(1, 1)]);
+        self.pattern_ = nil;  //recompile on next use
+    }
+    
+    /* Returns txt with all rules applied. */
+    apply(txt) {
+        if (self.rules_ == nil || 
+            self.firstChars_.indexWhich({c: txt.find(c) != nil}) == nil) {
+            return txt;  //no rule could match
+        }
+        if (self.pattern_ == nil) {
+            self.pattern_ = new RexPattern(
+                self.rules_.keysToList().mapAll({r: self.escape(r)}).join('|'));
+        }
+        return rexReplace(self.pattern_, txt, {m, idx, orig: self.rules_[m]}, 
+                          ReplaceAll);
+    }
+    
+    /* 
+     *   Returns a regex matching exactly the given literal text.  Most
+     *   punctuation is quoted with %, but %< and %> are word boundaries, 
+     *   so < and > need their named classes instead.
+     */
+    escape(str) {
+        return rexReplace('[^a-zA-Z0-9 ]', str, new function(m, idx, orig) {
+            if (m == '<') {
+                return '<langle>';
+            }else if (m == '>') {
+                return '<rangle>';
+            }
+            return '%' + m;
+        }, ReplaceAll);
+    }
+;
+
+/* 
+ *   Change Exit links to be object references, as the Skald client expects
+ *   (lowercased, with a ? prefix).
+ */
+PreinitObject
+    execute() {
+        foreach (local dir in ['North', 'South', 'East', 'West', 'Up', 'Down',
+                               'Northwest', 'Southwest', 'Northeast', 'Southeast']) {
+            skaldOutputFilter.addRule('<a href="' + dir + '"', 
+                                      '<a href="?' + dir.toLower() + '"');
+        }
+    }
+;
+
+/*
+ *   A static resource loaded into memory by SkaldWebResourceResFile.  Sends
+ *   an ETag with the contents so browsers can revalidate with a cheap 304.
+ */
+class SkaldCachedResource: object
+    contents = nil    //a String for text files; a ByteArray otherwise
+    mimeType = nil    //if nil, HTTPRequest infers it from the contents
+    etag = nil        //quoted hash of contents
+    immutable = nil   //if true, browsers may cache it without revalidating
+    variants = nil    //compressed copies, as [encoding, ByteArray, etag] lists
+    
+    /* how long (in seconds) browsers may cache immutable resources */
+    IMMUTABLE_MAX_AGE = 31536000
+    
+    construct(contents, mimeType, immutable) {
+        self.contents = contents;
+        self.mimeType = mimeType;
+        self.immutable = immutable;
+        self.etag = '"' + contents.digestMD5() + '"';
+    }
+    
+    /*
+     *   Adds a copy of the contents compressed with the given Content-Encoding
+     *   (such as 'gzip').  Variants added first are preferred.
+     */
+    addVariant(encoding, bytes) {
+        if (self.variants == nil) {
+            self.variants = [];
+        }
+        self.variants += [[encoding, bytes, 
+                           self.etag.substr(1, self.etag.length() - 1) + 
+                           '-' + encoding + '"']];
+    }
+    
+    /*
+     *   Sends this resource as the reply to the given HTTPRequest, or just a
+     *   304 if the request's If-None-Match shows the client already has it.
+     *   Sends the first compressed variant the request's Accept-Encoding 
+     *   allows, if any.
+     */
+    sendTo(req) {
+        local reqHeaders = req.getHeaders();
+        local body = self.contents;
+        local tag = self.etag;
+        local headers = ['Cache-Control: ' + 
+            (self.immutable ? 'public, max-age=' + self.IMMUTABLE_MAX_AGE + 
+            ', immutable' : 'no-cache')];
+        if (self.variants != nil) {
+            headers += 'Vary: Accept-Encoding';
+            local accept = reqHeaders['accept-encoding'];
+            local v = (accept == nil) ? nil : 
+                self.variants.valWhich({x: self.acceptsEncoding(accept, x[1])});
+            if (v != nil) {
+                body = v[2];
+                tag = v[3];
+                headers += 'Content-Encoding: ' + v[1];
+            }
+        }
+        headers += 'ETag: ' + tag;
+        
+        local match = reqHeaders['if-none-match'];
+        if (match != nil && (match == '*' || match.find(tag) != nil)) {
+            req.sendReply('', nil, 304, headers);
+        }else {
+            req.sendReply(body, self.mimeType, 200, headers);
+        }
+    }
+    
+    /*
+     *   Returns true if the given Accept-Encoding header value allows the
+     *   given encoding: that is, it is listed without a q of 0.
+     */
+    acceptsEncoding(accept, encoding) {
+        if (rexSearch('(^|[ ,])' + encoding + ' *(;[^,]*)?(,|$)', 
+                      accept.toLower()) == nil) {
+            return nil;
+        }
+        local params = rexGroup(2);
+        return params == nil || 
+            rexMatch('; *q *= *0(%.0*)? *$', params[3]) == nil;
+    }
+;
+
 /*
  *   The resource handler for our standard library resources.  All of the
  *   library resources are in the /htdocs resource folder.  This exposes
@@ -605,5 +1763,31 @@ class SkaldWebResourceResFile: SkaldWebResource
  */
 skaldWebResources: SkaldWebResourceResFile
     vpath = static new RexPattern('/htdocs')
+    
+    /* lists the web files; written by delivery/compress_htdocs.py */
+    MANIFEST = 'manifest.txt'
+    
+    /*
+     *   Returns the paths (relative to the given resource folder, which ends
+     *   in '/') of the files listed in that folder's MANIFEST, or [] if it
+     *   has no manifest.  Each manifest line is a path followed by the
+     *   encodings it has been compressed with, separated by spaces.
+     */
+    readManifest(dir) {
+        local paths = [];
+        local name = dir + self.MANIFEST;
+        if (!resExists(name)) {
+            return paths;
+        }
+        local fp = File.openTextResource(name);
+        for (local line = fp.readFile(); line != nil; line = fp.readFile()) {
+            local len = rexMatch('[^ \n]+', line);
+            if (len != nil && len > 0) {
+                paths += line.substr(1, len);
+            }
+        }
+        fp.closeFile();
+        return paths;
+    }
 ;
 